@@ -21,7 +21,7 @@ for my $ifile ( @topOrd ) {
 }
 my %includes;
 for my $ifile ( @topOrd ) {
-   %includes = (%includes, map { $_ => 1 } `grep "#include <" $ifile`);
+   %includes = (%includes, map { $_ => 1 } `grep -E '#include (<|"[^"]*\\.h")' $ifile`);
 }
 open(OFILE,">$resultFile");
 for my $prag ( sort keys %prags ) {
@@ -58,7 +58,8 @@ sub getIncludes {
    my $cppFile = $file;
    $cppFile =~ s!\.hpp!.cpp!g;
    for my $line ( `grep '^#include "' $file`, `grep '^#include "' $cppFile`  ) {
-      if ( $line =~ m/"([^"]*)"/ ) {
+      # C headers stay includes, their conditionals would not survive the merge
+      if ( $line =~ m/"([^"]*)"/ && $1 !~ m/\.h$/ ) {
          if ( $1 ne $cppFile && $1 ne $file ) {
             $res{$1} = 1;
          }
@@ -0,0 +1,259 @@
+#include "annotate.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+// Collects PGN move text and breaks it into lines.
+class MoveText {
+public:
+   void add(const std::string& token) {
+      if ( token == ")" ) {
+         line_ += token;
+         return;
+      }
+      if ( line_.size() + 1 + token.size() > PGN_LINE_LENGTH ) {
+         text_ += line_ + "\n";
+         line_.clear();
+      }
+      line_ += ( line_.empty() ? "" : " " ) + token;
+   }
+   std::string str() const { return text_ + line_ + "\n"; }
+
+private:
+   std::string text_;
+   std::string line_;
+};
+
+static std::string
+moveNumber(unsigned ply, bool white) {
+   return std::to_string(ply) + ( white ? "." : "..." );
+}
+
+// the pieces the side that just moved leaves attacked and not properly defended
+static std::string
+hangingPieces(const ChessBoard& board) {
+   const SquareControl control(board);
+   std::string retval;
+   Pos pos;
+   for ( pos.row = 0; pos.row < NUMBER_OF_ROWS; pos.row++ ) {
+      for ( pos.col = 0; pos.col < NUMBER_OF_COLS; pos.col++ ) {
+         const auto psq = board.getSquareUnsafe(pos);
+         if ( !psq.empty() && psq.color() != board.color_ && control.hanging(board, pos) ) {
+            retval += " ";
+            if ( psq.figure() != ChessFigure::Pawn ) {
+               retval += toChar(true, psq.figure());
+            }
+            retval += pos.pcol();
+            retval += pos.prow();
+         }
+      }
+   }
+   return retval;
+}
+
+// the side to move mates at once
+static bool
+canMate(const ChessBoard& board) {
+   ChessMoveVector moves;
+   ChessMoveVector replies;
+   board.listMoves(moves);
+   for ( const auto& move : moves ) {
+      ChessBoard next = board;
+      next.applyMove(move.from, move.to, move.promoteTo);
+      if ( next.check(next.color_) ) {
+         next.listMoves(replies);
+         if ( replies.empty() ) {
+            return true;
+         }
+      }
+   }
+   return false;
+}
+
+// the move into after allows a mate at once that another move would avoid, known for sure at any search time
+static bool
+allowsMate(const ChessBoard& before, const ChessBoard& after) {
+   if ( !canMate(after) ) {
+      return false;
+   }
+   ChessMoveVector moves;
+   before.listMoves(moves);
+   for ( const auto& move : moves ) {
+      ChessBoard next = before;
+      next.applyMove(move.from, move.to, move.promoteTo);
+      if ( !canMate(next) ) {
+         return true;
+      }
+   }
+   return false;
+}
+
+std::string
+Annotator::annotate(const Game& game, Search& search) const {
+   std::stringstream ss;
+   std::string result = "*";
+   if ( game.headers.empty() ) {
+      ss << "[Event \"" << game.tag << "\"]" << std::endl;
+      // the rest of the seven tag roster, unknown
+      ss << "[Site \"?\"]" << std::endl << "[Date \"????.??.??\"]" << std::endl << "[Round \"?\"]" << std::endl;
+      ss << "[White \"?\"]" << std::endl << "[Black \"?\"]" << std::endl << "[Result \"" << result << "\"]" << std::endl;
+      if ( !game.fen.empty() ) {
+         ss << "[SetUp \"1\"]" << std::endl;
+         ss << "[FEN \"" << game.fen << "\"]" << std::endl;
+      }
+   }
+   for ( const auto& elem : game.headers ) {
+      ss << "[" << elem.first << " \"" << elem.second << "\"]" << std::endl;
+      if ( elem.first == "Result" ) {
+         result = elem.second;
+      }
+   }
+   ss << "[Annotator \"" << ENGINE_NAME << "\"]" << std::endl << std::endl;
+
+   ChessBoard board;
+   MoveText text;
+   if ( !game.start(board) ) {
+      text.add("{invalid FEN}");
+      text.add(result);
+      return ss.str() + text.str() + "\n";
+   }
+
+   // the positions of the game and the moves between them
+   std::vector<ChessBoard> boards(1, board);
+   ChessMoveVector played;
+   std::string failure;
+   for ( const auto& token : game.moves ) {
+      ChessBoard next = boards.back();
+      if ( !next.move(token) || !next.valid() ) {
+         failure = token;
+         break;
+      }
+      ChessMoveVector moves;
+      boards.back().listMoves(moves);
+      for ( const auto& move : moves ) {
+         ChessBoard probe = boards.back();
+         probe.applyMove(move.from, move.to, move.promoteTo);
+         if ( probe.hash() == next.hash() ) {
+            played.push_back(move);
+            break;
+         }
+      }
+      boards.push_back(next);
+   }
+
+   PositionHistory history;
+   history.push(boards[0]);
+   Analysis after = analyse(boards[0], history, search);
+   bool numbered = false;
+   unsigned fullMove = boards[0].clocks_[FULL_CLOCK] ? boards[0].clocks_[FULL_CLOCK] : 1;
+   for ( size_t i = 0; i < played.size(); i++ ) {
+      const ChessBoard& before = boards[i];
+      const Analysis analysis = after;
+      const ChessMoveVector& line = analysis.line;
+      history.push(boards[i + 1]);
+      after = analyse(boards[i + 1], history, search);
+      // a score in [0, 1] varies by at most 1/4, so a loss within the noise of the visits is no loss
+      const double noise = std::sqrt(0.25 / std::max(1u, analysis.bestVisits) + 0.25 / std::max(1u, after.visits));
+      double loss = analysis.bestScore - after.value;
+      if ( ( !line.empty() && played[i] == line[0] ) || loss <= MARK_CONFIDENCE * noise ) {
+         loss = 0.0;
+      }
+      if ( allowsMate(before, boards[i + 1]) ) {
+         loss = 1.0;
+      }
+
+      if ( before.color_ || !numbered ) {
+         text.add(moveNumber(fullMove, before.color_));
+      }
+      numbered = true;
+      text.add(toSAN(before, played[i]) + ( loss >= BLUNDER_LOSS ? "??" : loss >= MISTAKE_LOSS ? "?" : "" ));
+      if ( loss >= MISTAKE_LOSS ) {
+         const auto hanging = hangingPieces(boards[i + 1]);
+         if ( !hanging.empty() ) {
+            text.add("{hangs" + hanging + "}");
+         }
+         // a short search may have had the played move as its best one
+         if ( !line.empty() && !( played[i] == line[0] ) ) {
+            ChessBoard pos = before;
+            for ( size_t j = 0; j < line.size(); j++ ) {
+               if ( !j || pos.color_ ) {
+                  text.add(( j ? "" : "(" ) + moveNumber(fullMove + ( j + !before.color_ ) / 2, pos.color_));
+               }
+               text.add(toSAN(pos, line[j]));
+               pos.applyMove(line[j].from, line[j].to, line[j].promoteTo);
+            }
+            text.add(")");
+            numbered = false;
+         }
+      }
+      fullMove += !before.color_;
+   }
+   if ( !failure.empty() ) {
+      text.add("{cannot apply " + failure + "}");
+   }
+   text.add(result);
+   return ss.str() + text.str() + "\n";
+}
+
+Analysis
+Annotator::analyse(const ChessBoard& board, const PositionHistory& history, Search& search) const {
+   Analysis analysis;
+   if ( cache_ && cache_->find(board, analysis) && analysis.milliseconds >= milliseconds_ ) {
+      return analysis;
+   }
+   search.run(board, history, milliseconds_);
+   analysis = Analysis();
+   analysis.value = search.value(board, analysis.visits);
+   analysis.iterations = search.iterations();
+   analysis.milliseconds = milliseconds_;
+   const auto best = search.best(board);
+   unsigned visits;
+   if ( best.from.valid() ) {
+      analysis.bestScore = search.score(board, best, analysis.bestVisits);
+   }
+   ChessBoard pos = board;
+   for ( auto move = best; analysis.line.size() < MAIN_LINE_PLIES && move.from.valid() && ( analysis.line.empty() || ( search.score(pos, move, visits), visits ) ); move = search.best(pos) ) {
+      analysis.line.push_back(move);
+      pos.applyMove(move.from, move.to, move.promoteTo);
+   }
+   if ( cache_ ) {
+      cache_->store(board, analysis);
+   }
+   return analysis;
+}
+
+void
+Annotator::run(const std::vector<Game>& games, std::ostream& os) {
+   const unsigned workers = std::max<unsigned>(1, std::min<size_t>(threads_, games.size()));
+   std::atomic<size_t> next{0};
+   std::mutex mutex;
+   std::vector<std::string> outputs(games.size());
+   std::vector<bool> done(games.size(), false);
+   size_t written = 0;
+   auto work = [&]() {
+      Search search(bitbases_, megabytes_);
+      search.setThreads(threads_ / workers);
+      for ( size_t i = next++; i < games.size(); i = next++ ) {
+         search.clear();
+         auto output = annotate(games[i], search);
+         std::lock_guard<std::mutex> lock(mutex);
+         outputs[i].swap(output);
+         done[i] = true;
+         for ( ; written < games.size() && done[written]; written++ ) {
+            os << outputs[written];
+            std::string().swap(outputs[written]);
+         }
+      }
+   };
+   std::vector<std::thread> helpers;
+   for ( unsigned i = 1; i < workers; i++ ) {
+      helpers.push_back(std::thread(work));
+   }
+   work();
+   for ( auto& elem : helpers ) {
+      elem.join();
+   }
+}
@@ -0,0 +1,41 @@
+#ifndef ANNOTATE_H
+#define ANNOTATE_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "bitbase.hpp"
+#include "cache.hpp"
+#include "notation.hpp"
+#include "search.hpp"
+
+constexpr double MISTAKE_LOSS = 0.15;
+constexpr double BLUNDER_LOSS = 0.3;
+constexpr double MARK_CONFIDENCE = 2.0; // standard errors a loss has to exceed to get marked
+constexpr unsigned MAIN_LINE_PLIES = 6;
+constexpr unsigned PGN_LINE_LENGTH = 79;
+
+// Annotates whole games into PGN, games are spread over the threads and every game reuses its search table along the moves.
+// Only the moves losing a good part of the expected score, beyond the noise of the samples, or allowing a mate at once that
+// another move avoids get marked, together with the line we would rather play.
+class Annotator {
+public:
+   Annotator(const Bitbases* bitbases, unsigned milliseconds, unsigned threads, size_t megabytes, AnalysisCache* cache = nullptr)
+      : bitbases_(bitbases), milliseconds_(milliseconds), threads_(std::max(1u, threads)), megabytes_(megabytes), cache_(cache) {}
+
+   // writes the games in their original order as soon as they and all their predecessors are ready
+   void run(const std::vector<Game>& games, std::ostream& os);
+   std::string annotate(const Game& game, Search& search) const;
+   // searches the position unless the cache has an analysis at least as long
+   Analysis analyse(const ChessBoard& board, const PositionHistory& history, Search& search) const;
+
+private:
+   const Bitbases* bitbases_;
+   unsigned milliseconds_;
+   unsigned threads_;
+   size_t megabytes_;
+   AnalysisCache* cache_;
+};
+
+#endif /* ANNOTATE_H */
@@ -0,0 +1,437 @@
+#include "batch.hpp"
+
+#include <algorithm>
+#include <cctype>
+
+static unsigned
+lowest(unsigned long long set) {
+   return __builtin_ctzll(set);
+}
+
+static unsigned
+highest(unsigned long long set) {
+   return 63 - __builtin_clzll(set);
+}
+
+static unsigned
+popCount(unsigned long long set) {
+   return __builtin_popcountll(set);
+}
+
+static unsigned long long
+bit(unsigned sq) {
+   return 1ULL << sq;
+}
+
+BitboardTables::BitboardTables() : between(), line() {
+   const std::array<Pos, NUMBER_OF_DIRS> dirs = {Pos(+1, 0), Pos(-1, 0), Pos(0, +1), Pos(0, -1), Pos(+1, +1), Pos(-1, -1), Pos(+1, -1), Pos(-1, +1)}; // opposite directions in pairs
+   for ( unsigned sq = 0; sq < NUMBER_OF_SQUARES; sq++ ) {
+      const Pos from = PosFromCode(sq);
+      knight[sq] = king[sq] = pawn[WHITE][sq] = pawn[BLACK][sq] = 0;
+      for ( int row = -2; row <= 2; row++ ) {
+         for ( int col = -2; col <= 2; col++ ) {
+            const Pos to = from.add(Pos(row, col));
+            if ( !to.valid() ) {
+               continue;
+            }
+            if ( tabs(row * col) == 2 ) {
+               knight[sq] |= bit(to.code());
+            } else if ( ( row || col ) && tabs(row) <= 1 && tabs(col) <= 1 ) {
+               king[sq] |= bit(to.code());
+               if ( col && row ) {
+                  pawn[row > 0 ? WHITE : BLACK][sq] |= bit(to.code());
+               }
+            }
+         }
+      }
+      for ( unsigned d = 0; d < NUMBER_OF_DIRS; d++ ) {
+         axial[d] = dirs[d].isAxialDir();
+         ascending[d] = dirs[d].row > 0 || ( !dirs[d].row && dirs[d].col > 0 );
+         rays[d][sq] = 0;
+         unsigned long long acc = 0;
+         for ( Pos to = from.add(dirs[d]); to.valid(); to.move(dirs[d]) ) {
+            between[sq][to.code()] = acc;
+            acc |= bit(to.code());
+            rays[d][sq] |= bit(to.code());
+         }
+      }
+   }
+   for ( unsigned sq = 0; sq < NUMBER_OF_SQUARES; sq++ ) {
+      for ( unsigned d = 0; d < NUMBER_OF_DIRS; d++ ) {
+         for ( auto set = rays[d][sq]; set; set &= set - 1 ) {
+            line[sq][lowest(set)] = rays[d][sq] | rays[d ^ 1][sq] | bit(sq);
+         }
+      }
+   }
+}
+
+const BitboardTables BITBOARDS;
+
+static unsigned long long
+rayAttacks(unsigned d, unsigned sq, unsigned long long occ) {
+   unsigned long long retval = BITBOARDS.rays[d][sq];
+   const unsigned long long blockers = retval & occ;
+   if ( blockers ) {
+      retval ^= BITBOARDS.rays[d][BITBOARDS.ascending[d] ? lowest(blockers) : highest(blockers)];
+   }
+   return retval;
+}
+
+static unsigned long long
+sliderAttacks(bool axial, unsigned sq, unsigned long long occ) {
+   unsigned long long retval = 0;
+   for ( unsigned d = 0; d < NUMBER_OF_DIRS; d++ ) {
+      if ( BITBOARDS.axial[d] == axial ) {
+         retval |= rayAttacks(d, sq, occ);
+      }
+   }
+   return retval;
+}
+
+template <int S>
+unsigned long long
+shift(unsigned long long set) {
+   return S > 0 ? set << (S & 63) : set >> ((-S) & 63);
+}
+
+// Kogge-Stone fill of the sliders through the empty squares, one direction, the result is the attacked squares
+template <int S, unsigned long long M>
+unsigned long long
+slide(unsigned long long gen, unsigned long long pro) {
+   pro &= M;
+   gen |= pro & shift<S>(gen);
+   pro &= shift<S>(pro);
+   gen |= pro & shift<2 * S>(gen);
+   pro &= shift<2 * S>(pro);
+   gen |= pro & shift<4 * S>(gen);
+   return shift<S>(gen) & M;
+}
+
+void
+BatchPlayout::updateAttacks() {
+   const auto& pawns = figures_[static_cast<unsigned>(ChessFigure::Pawn)];
+   const auto& knights = figures_[static_cast<unsigned>(ChessFigure::Knight)];
+   const auto& bishops = figures_[static_cast<unsigned>(ChessFigure::Bishop)];
+   const auto& rooks = figures_[static_cast<unsigned>(ChessFigure::Rook)];
+   const auto& queens = figures_[static_cast<unsigned>(ChessFigure::Queen)];
+   const auto& kings = figures_[static_cast<unsigned>(ChessFigure::King)];
+   // branch free over the lanes, so the compiler can run it on the vector units
+   for ( unsigned i = 0; i < BATCH_LANES; i++ ) {
+      const unsigned long long white = 0ULL - color_[i];
+      const unsigned long long own = ( colors_[WHITE][i] & white ) | ( colors_[BLACK][i] & ~white );
+      const unsigned long long opp = ( colors_[BLACK][i] & white ) | ( colors_[WHITE][i] & ~white );
+      const unsigned long long empty = ~( opp | ( own & ~kings[i] ) );
+      const unsigned long long rq = ( rooks[i] | queens[i] ) & opp;
+      const unsigned long long bq = ( bishops[i] | queens[i] ) & opp;
+      const unsigned long long n = knights[i] & opp;
+      const unsigned long long k = kings[i] & opp;
+      const unsigned long long p = pawns[i] & opp;
+      unsigned long long att = slide<8, ~0ULL>(rq, empty) | slide<-8, ~0ULL>(rq, empty) | slide<1, ~FILE_A>(rq, empty) | slide<-1, ~FILE_H>(rq, empty);
+      att |= slide<9, ~FILE_A>(bq, empty) | slide<7, ~FILE_H>(bq, empty) | slide<-7, ~FILE_A>(bq, empty) | slide<-9, ~FILE_H>(bq, empty);
+      att |= ( ( n << 17 | n >> 15 ) & ~FILE_A ) | ( ( n << 15 | n >> 17 ) & ~FILE_H );
+      att |= ( ( n << 10 | n >> 6 ) & ~( FILE_A | FILE_B ) ) | ( ( n << 6 | n >> 10 ) & ~( FILE_G | FILE_H ) );
+      att |= k << 8 | k >> 8 | ( ( k << 1 | k << 9 | k >> 7 ) & ~FILE_A ) | ( ( k >> 1 | k >> 9 | k << 7 ) & ~FILE_H );
+      att |= ( ( ( p >> 7 & ~FILE_A ) | ( p >> 9 & ~FILE_H ) ) & white ) | ( ( ( p << 9 & ~FILE_A ) | ( p << 7 & ~FILE_H ) ) & ~white );
+      attacked_[i] = att;
+   }
+}
+
+unsigned long long
+BatchPlayout::attackers(unsigned lane, unsigned sq, unsigned long long occ) const {
+   const bool color = color_[lane];
+   const unsigned long long opp = colors_[!color][lane];
+   const unsigned long long rq = ( figures_[static_cast<unsigned>(ChessFigure::Rook)][lane] | figures_[static_cast<unsigned>(ChessFigure::Queen)][lane] ) & opp;
+   const unsigned long long bq = ( figures_[static_cast<unsigned>(ChessFigure::Bishop)][lane] | figures_[static_cast<unsigned>(ChessFigure::Queen)][lane] ) & opp;
+   unsigned long long retval = BITBOARDS.knight[sq] & figures_[static_cast<unsigned>(ChessFigure::Knight)][lane];
+   retval |= BITBOARDS.king[sq] & figures_[static_cast<unsigned>(ChessFigure::King)][lane];
+   retval |= BITBOARDS.pawn[color][sq] & figures_[static_cast<unsigned>(ChessFigure::Pawn)][lane];
+   retval &= opp;
+   if ( rq ) {
+      retval |= sliderAttacks(true, sq, occ) & rq;
+   }
+   if ( bq ) {
+      retval |= sliderAttacks(false, sq, occ) & bq;
+   }
+   return retval;
+}
+
+void
+BatchPlayout::set(unsigned lane, unsigned sq, unsigned char data) {
+   const unsigned char old = squares_[lane][sq];
+   key_[lane] ^= ZOBRIST.squares[sq][old] ^ ZOBRIST.squares[sq][data];
+   squares_[lane][sq] = data;
+   if ( !ChessSquare(old).empty() ) {
+      figures_[old >> 1][lane] &= ~bit(sq);
+      colors_[old & 1][lane] &= ~bit(sq);
+   }
+   if ( !ChessSquare(data).empty() ) {
+      figures_[data >> 1][lane] |= bit(sq);
+      colors_[data & 1][lane] |= bit(sq);
+   }
+}
+
+void
+BatchPlayout::load(unsigned lane, const ChessBoard& board, unsigned long long seed) {
+   for ( unsigned sq = 0; sq < NUMBER_OF_SQUARES; sq++ ) {
+      set(lane, sq, board.getSquare(PosFromCode(sq)).data());
+   }
+   key_[lane] = board.hash();
+   color_[lane] = board.color_;
+   for ( unsigned i = 0; i < NUMBER_OF_CASTS; i++ ) {
+      casts_[lane][i] = board.casts_[i] == CHAR_INVALID ? -1 : toupper(board.casts_[i]) - 'A';
+   }
+   enpassant_[lane] = board.enpassant_ == CHAR_INVALID ? -1 : board.enpassant_ - 'a';
+   enpassantKey_[lane] = board.hasEnpassantCapture();
+   halfClock_[lane] = board.clocks_[HALF_CLOCK];
+   plies_[lane] = 0;
+   history_[lane].clear();
+   history_[lane].push(key_[lane]);
+   rng_[lane] = Random(seed);
+}
+
+bool
+BatchPlayout::isCastleValid(unsigned lane, unsigned king, unsigned rook, unsigned long long occ) const {
+   const unsigned row = color_[lane] ? FIRST_ROW : LAST_ROW;
+   if ( king >> 3 != row ) {
+      return false;
+   }
+   const bool isLong = rook < king;
+   const unsigned kingTarget = row * NUMBER_OF_COLS + ( isLong ? LONG_CASTLE_KING : SHORT_CASTLE_KING );
+   const unsigned rookTarget = row * NUMBER_OF_COLS + ( isLong ? LONG_CASTLE_ROOK : SHORT_CASTLE_ROOK );
+   const unsigned long long others = occ & ~bit(king) & ~bit(rook);
+   for ( unsigned sq = std::min(king, kingTarget); sq <= std::max(king, kingTarget); sq++ ) {
+      if ( ( others & bit(sq) ) || attackers(lane, sq, occ) ) {
+         return false;
+      }
+   }
+   for ( unsigned sq = std::min(rook, rookTarget); sq <= std::max(rook, rookTarget); sq++ ) {
+      if ( others & bit(sq) ) {
+         return false;
+      }
+   }
+   return true;
+}
+
+void
+BatchPlayout::applyMove(unsigned lane, unsigned from, unsigned to, ChessFigure promoteTo) {
+   const bool color = color_[lane];
+   const ChessSquare ssq(squares_[lane][from]);
+   const ChessSquare tsq(squares_[lane][to]);
+   auto& casts = casts_[lane];
+   for ( unsigned i = 0; i < NUMBER_OF_CASTS; i++ ) {
+      if ( casts[i] >= 0 ) {
+         key_[lane] ^= ZOBRIST.casts[i * NUMBER_OF_COLS + casts[i]];
+      }
+   }
+   auto castSquare = [&](unsigned i) { return unsigned( ( i < CASTS_SIDES ? FIRST_ROW : LAST_ROW ) * NUMBER_OF_COLS + casts[i] ); };
+   const unsigned sofs = color ? 0 : CASTS_SIDES;
+   for ( unsigned i = sofs; i < sofs + CASTS_SIDES; i++ ) {
+      if ( ssq.figure() == ChessFigure::King || ( ssq.figure() == ChessFigure::Rook && casts[i] >= 0 && castSquare(i) == from ) ) {
+         casts[i] = -1;
+      }
+   }
+   for ( unsigned i = CASTS_SIDES - sofs; i < NUMBER_OF_CASTS - sofs; i++ ) {
+      if ( casts[i] >= 0 && castSquare(i) == to ) {
+         casts[i] = -1;
+      }
+   }
+
+   const unsigned row = from & ~7u;
+   if ( ssq == ChessSquare(ChessFigure::King, tsq.color()) && tsq.figure() == ChessFigure::Rook ) {
+      set(lane, from, 0);
+      set(lane, to, 0);
+      set(lane, row + ( to < from ? LONG_CASTLE_KING : SHORT_CASTLE_KING ), ChessSquare(ChessFigure::King, color).data());
+      set(lane, row + ( to < from ? LONG_CASTLE_ROOK : SHORT_CASTLE_ROOK ), ChessSquare(ChessFigure::Rook, color).data());
+   } else {
+      set(lane, from, 0);
+      const bool promotion = ssq.figure() == ChessFigure::Pawn && to >> 3 == unsigned( color ? LAST_ROW : FIRST_ROW );
+      set(lane, to, promotion ? ChessSquare(promoteTo, color).data() : ssq.data());
+   }
+   if ( ssq.figure() == ChessFigure::Pawn && enpassant_[lane] >= 0 && to == unsigned( color ? LAST_EMP_ROW : FIRST_EMP_ROW ) * NUMBER_OF_COLS + enpassant_[lane] ) {
+      set(lane, color ? to - NUMBER_OF_COLS : to + NUMBER_OF_COLS, 0);
+   }
+
+   color_[lane] = !color;
+   key_[lane] ^= ZOBRIST.color;
+   halfClock_[lane] = ssq.figure() == ChessFigure::Pawn || !tsq.empty() ? 0 : halfClock_[lane] + 1;
+   if ( enpassantKey_[lane] ) {
+      key_[lane] ^= ZOBRIST.enpassant[enpassant_[lane]];
+   }
+   enpassant_[lane] = ssq.figure() == ChessFigure::Pawn && ( from > to ? from - to : to - from ) == 2 * NUMBER_OF_COLS ? to & 7 : -1;
+   enpassantKey_[lane] = false;
+   if ( enpassant_[lane] >= 0 ) {
+      // a capturing pawn of the side to move that does not leave its king attacked
+      const unsigned long long occ = colors_[0][lane] | colors_[1][lane];
+      const unsigned king = lowest(figures_[static_cast<unsigned>(ChessFigure::King)][lane] & colors_[!color][lane]);
+      const unsigned target = ( color ? to - NUMBER_OF_COLS : to + NUMBER_OF_COLS );
+      for ( auto set = BITBOARDS.pawn[color][target] & figures_[static_cast<unsigned>(ChessFigure::Pawn)][lane] & colors_[!color][lane]; set; set &= set - 1 ) {
+         enpassantKey_[lane] = enpassantKey_[lane] || !( attackers(lane, king, ( occ ^ bit(lowest(set)) ^ bit(to) ) | bit(target) ) & ~bit(to) );
+      }
+      if ( enpassantKey_[lane] ) {
+         key_[lane] ^= ZOBRIST.enpassant[enpassant_[lane]];
+      }
+   }
+   for ( unsigned i = 0; i < NUMBER_OF_CASTS; i++ ) {
+      if ( casts[i] >= 0 ) {
+         key_[lane] ^= ZOBRIST.casts[i * NUMBER_OF_COLS + casts[i]];
+      }
+   }
+}
+
+bool
+BatchPlayout::step(unsigned lane, int& result) {
+   const bool color = color_[lane];
+   const unsigned long long own = colors_[color][lane];
+   const unsigned long long opp = colors_[!color][lane];
+   const unsigned long long occ = own | opp;
+
+   if ( bitbases_ && ( !plies_[lane] || !halfClock_[lane] ) && popCount(occ) <= BITBASE_MAX_FIGURES + NUMBER_OF_KINGS ) {
+      ChessBoard board;
+      board.color_ = color;
+      for ( auto set = occ; set; set &= set - 1 ) {
+         board.set(PosFromCode(lowest(set)), ChessSquare(squares_[lane][lowest(set)]));
+      }
+      if ( bitbases_->probe(board, result) ) {
+         result = color ? result : -result;
+         return true;
+      }
+   }
+
+   // legal targets of every piece, in the square order of listMoves
+   const unsigned king = lowest(figures_[static_cast<unsigned>(ChessFigure::King)][lane] & own);
+   const unsigned long long checkers = attackers(lane, king, occ);
+   unsigned long long allowed = ~own;
+   if ( checkers ) {
+      allowed &= checkers & ( checkers - 1 ) ? 0 : checkers | BITBOARDS.between[king][lowest(checkers)];
+   }
+   unsigned long long pinned = 0;
+   for ( unsigned d = 0; d < NUMBER_OF_DIRS; d++ ) {
+      const unsigned long long blocker = rayAttacks(d, king, occ) & own;
+      if ( blocker ) {
+         const unsigned long long sliders = figures_[static_cast<unsigned>(ChessFigure::Queen)][lane] | figures_[static_cast<unsigned>(BITBOARDS.axial[d] ? ChessFigure::Rook : ChessFigure::Bishop)][lane];
+         if ( rayAttacks(d, lowest(blocker), occ) & opp & sliders ) {
+            pinned |= blocker;
+         }
+      }
+   }
+   const unsigned promotionRow = color ? LAST_PAWN_ROW : FIRST_PAWN_ROW;
+   std::array<std::pair<unsigned char, unsigned long long>, 16> pieces;
+   unsigned size = 0;
+   unsigned count = 0;
+   for ( auto set = own; set; set &= set - 1 ) {
+      const unsigned from = lowest(set);
+      unsigned long long targets = 0;
+      const ChessFigure figure = ChessSquare(squares_[lane][from]).figure();
+      switch ( figure ) {
+         case ChessFigure::Pawn:
+            {
+               const unsigned forward = color ? from + NUMBER_OF_COLS : from - NUMBER_OF_COLS;
+               targets = BITBOARDS.pawn[color][from] & opp;
+               if ( !( occ & bit(forward) ) ) {
+                  targets |= bit(forward);
+                  const unsigned fast = color ? forward + NUMBER_OF_COLS : forward - NUMBER_OF_COLS;
+                  if ( from >> 3 == unsigned( color ? FIRST_PAWN_ROW : LAST_PAWN_ROW ) && !( occ & bit(fast) ) ) {
+                     targets |= bit(fast);
+                  }
+               }
+               targets &= allowed;
+               if ( enpassant_[lane] >= 0 ) {
+                  const unsigned target = ( color ? LAST_EMP_ROW : FIRST_EMP_ROW ) * NUMBER_OF_COLS + enpassant_[lane];
+                  const unsigned captured = color ? target - NUMBER_OF_COLS : target + NUMBER_OF_COLS;
+                  if ( ( BITBOARDS.pawn[color][from] & bit(target) ) && !( attackers(lane, king, ( occ ^ bit(from) ^ bit(captured) ) | bit(target) ) & ~bit(captured) ) ) {
+                     targets |= bit(target);
+                  }
+               }
+            }
+            break;
+         case ChessFigure::Knight:
+            targets = BITBOARDS.knight[from] & allowed;
+            break;
+         case ChessFigure::Bishop:
+         case ChessFigure::Rook:
+            targets = sliderAttacks(figure == ChessFigure::Rook, from, occ) & allowed;
+            break;
+         case ChessFigure::Queen:
+            targets = ( sliderAttacks(true, from, occ) | sliderAttacks(false, from, occ) ) & allowed;
+            break;
+         default:
+            targets = BITBOARDS.king[from] & ~own & ~attacked_[lane];
+            for ( unsigned i = 0; !checkers && i < CASTS_SIDES; i++ ) {
+               const signed char col = casts_[lane][( color ? 0 : CASTS_SIDES ) + i];
+               const unsigned rook = ( color ? FIRST_ROW : LAST_ROW ) * NUMBER_OF_COLS + col;
+               if ( col >= 0 && isCastleValid(lane, from, rook, occ) ) {
+                  targets |= bit(rook);
+               }
+            }
+      }
+      if ( ( pinned & bit(from) ) ) {
+         targets &= BITBOARDS.line[king][from];
+      }
+      if ( targets ) {
+         pieces[size++] = std::make_pair(from, targets);
+         count += popCount(targets) << ( figure == ChessFigure::Pawn && from >> 3 == promotionRow ? 2 : 0 );
+      }
+   }
+
+   if ( !count ) {
+      result = checkers ? ( color ? -1 : +1 ) : 0;
+      return true;
+   }
+   if ( halfClock_[lane] >= FIFTY_MOVES_CLOCK || history_[lane].repetitions(halfClock_[lane]) ) {
+      result = 0;
+      return true;
+   }
+
+   unsigned pick = rng_[lane].below(count);
+   for ( unsigned i = 0; ; i++ ) {
+      const unsigned from = pieces[i].first;
+      const bool promotion = ChessSquare(squares_[lane][from]).figure() == ChessFigure::Pawn && from >> 3 == promotionRow;
+      const unsigned moves = popCount(pieces[i].second) << ( promotion ? 2 : 0 );
+      if ( pick >= moves ) {
+         pick -= moves;
+         continue;
+      }
+      auto targets = pieces[i].second;
+      for ( unsigned j = promotion ? pick >> 2 : pick; j > 0; j-- ) {
+         targets &= targets - 1;
+      }
+      const std::array<ChessFigure, 4> promotions = {ChessFigure::Knight, ChessFigure::Bishop, ChessFigure::Rook, ChessFigure::Queen};
+      applyMove(lane, from, lowest(targets), promotion ? promotions[pick & 3] : ChessFigure::None);
+      break;
+   }
+   history_[lane].push(key_[lane]);
+   plies_[lane]++;
+   return false;
+}
+
+void
+BatchPlayout::run(std::vector<PlayoutJob>& jobs) {
+   std::array<size_t, BATCH_LANES> lanes;
+   size_t next = 0;
+   unsigned active = 0;
+   for ( unsigned i = 0; i < BATCH_LANES; i++ ) {
+      lanes[i] = next < jobs.size() ? next++ : jobs.size();
+      if ( lanes[i] < jobs.size() ) {
+         load(i, jobs[lanes[i]].board, jobs[lanes[i]].seed);
+         active++;
+      }
+   }
+   while ( active ) {
+      updateAttacks();
+      for ( unsigned i = 0; i < BATCH_LANES; i++ ) {
+         int result;
+         if ( lanes[i] >= jobs.size() || !step(i, result) ) {
+            continue;
+         }
+         jobs[lanes[i]].result = result;
+         jobs[lanes[i]].plies = plies_[i];
+         if ( next < jobs.size() ) {
+            lanes[i] = next++;
+            load(i, jobs[lanes[i]].board, jobs[lanes[i]].seed);
+         } else {
+            lanes[i] = jobs.size();
+            active--;
+         }
+      }
+   }
+}
@@ -0,0 +1,75 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <array>
+#include <vector>
+
+#include "bitbase.hpp"
+#include "playout.hpp"
+#include "primitives.hpp"
+
+constexpr unsigned BATCH_LANES = 64;
+constexpr unsigned NUMBER_OF_DIRS = 8;
+constexpr unsigned long long FILE_A = 0x0101010101010101ULL;
+constexpr unsigned long long FILE_B = FILE_A << 1;
+constexpr unsigned long long FILE_G = FILE_A << 6;
+constexpr unsigned long long FILE_H = FILE_A << 7;
+
+typedef std::array<unsigned long long, NUMBER_OF_SQUARES> SquareSets;
+
+// Attack and line tables, bit i of a set is the square with code i.
+struct BitboardTables {
+   BitboardTables();
+   SquareSets knight;
+   SquareSets king;
+   std::array<SquareSets, 2> pawn; // attacked by a pawn of the color
+   std::array<SquareSets, NUMBER_OF_DIRS> rays;
+   std::array<SquareSets, NUMBER_OF_SQUARES> between;
+   std::array<SquareSets, NUMBER_OF_SQUARES> line; // empty unless the squares share a line
+   std::array<bool, NUMBER_OF_DIRS> axial;
+   std::array<bool, NUMBER_OF_DIRS> ascending;
+};
+extern const BitboardTables BITBOARDS;
+
+struct PlayoutJob {
+   ChessBoard board;
+   unsigned long long seed;
+   int result;
+   unsigned plies;
+};
+
+// Many playouts at once on bitboards laid out as structure of arrays over the lanes.
+// A lane plays exactly the game of Playout::run with Random(seed): same move order, same random draws.
+class BatchPlayout {
+public:
+   explicit BatchPlayout(const Bitbases* bitbases = nullptr) : bitbases_(bitbases) {}
+
+   // lanes are refilled with the next job as soon as their game ends
+   void run(std::vector<PlayoutJob>& jobs);
+
+private:
+   void load(unsigned lane, const ChessBoard& board, unsigned long long seed);
+   void set(unsigned lane, unsigned sq, unsigned char data);
+   void updateAttacks();
+   unsigned long long attackers(unsigned lane, unsigned sq, unsigned long long occ) const;
+   bool isCastleValid(unsigned lane, unsigned king, unsigned rook, unsigned long long occ) const;
+   void applyMove(unsigned lane, unsigned from, unsigned to, ChessFigure promoteTo);
+   bool step(unsigned lane, int& result);
+
+   const Bitbases* bitbases_;
+   std::array<std::array<unsigned long long, BATCH_LANES>, 7> figures_ {}; // by ChessFigure
+   std::array<std::array<unsigned long long, BATCH_LANES>, 2> colors_ {};
+   std::array<unsigned long long, BATCH_LANES> attacked_ {}; // by the side not to move, through the own king
+   std::array<unsigned char, BATCH_LANES> color_ {};
+   std::array<std::array<signed char, NUMBER_OF_CASTS>, BATCH_LANES> casts_ {}; // rook columns
+   std::array<signed char, BATCH_LANES> enpassant_ {};
+   std::array<bool, BATCH_LANES> enpassantKey_ {}; // the file is in the key, see ChessBoard::hasEnpassantCapture
+   std::array<unsigned char, BATCH_LANES> halfClock_ {};
+   std::array<unsigned, BATCH_LANES> plies_ {};
+   std::array<unsigned long long, BATCH_LANES> key_ {};
+   std::array<std::array<unsigned char, NUMBER_OF_SQUARES>, BATCH_LANES> squares_ {};
+   std::array<PositionHistory, BATCH_LANES> history_;
+   std::array<Random, BATCH_LANES> rng_;
+};
+
+#endif /* BATCH_H */
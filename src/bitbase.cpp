@@ -0,0 +1,401 @@
+#include "bitbase.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+constexpr unsigned char BITBASE_STALEMATE = 4; // settled draw while generating
+
+struct BitbaseHeader {
+   char magic[BITBASE_SIGNATURE_SIZE];
+   std::uint32_t version;
+   std::uint32_t count;
+};
+
+struct BitbaseEntry {
+   char signature[BITBASE_SIGNATURE_SIZE];
+   std::uint64_t offset;
+   std::uint64_t size;
+};
+
+Bitbases::~Bitbases() {
+   if ( mapping_ ) {
+      munmap(mapping_, mappingSize_);
+   }
+}
+
+std::string
+Bitbases::canonical(const std::string& signature) {
+   std::string figures;
+   for ( const auto& chr : signature ) {
+      figures += toupper(chr);
+   }
+   if ( figures.size() < 2 || figures.size() > BITBASE_MAX_FIGURES + 2 || figures.front() != 'K' || figures.back() != 'K' ) {
+      return std::string();
+   }
+   figures = figures.substr(1, figures.size() - 2);
+   for ( const auto& chr : figures ) {
+      if ( BITBASE_FIGURE_ORDER.find(chr) == std::string::npos ) {
+         return std::string();
+      }
+   }
+   std::sort(figures.begin(), figures.end(), [](char lhs, char rhs) { return BITBASE_FIGURE_ORDER.find(lhs) < BITBASE_FIGURE_ORDER.find(rhs); });
+   return "K" + figures + "K";
+}
+
+bool
+Bitbases::decode(const std::string& signature, size_t idx, ChessBoard& board) const {
+   board = ChessBoard();
+   board.color_ = idx & 1;
+   idx >>= 1;
+   for ( size_t i = 0; i < signature.size(); i++, idx >>= 6 ) {
+      const Pos pos = PosFromCode(idx & 63);
+      const ChessFigure fig = toFigure(signature[i]);
+      if ( !board.isEmpty(pos) || ( fig == ChessFigure::Pawn && ( pos.row == FIRST_ROW || pos.row == LAST_ROW ) ) ) {
+         return false;
+      }
+      board.set(pos, ChessSquare(fig, i + 1 < signature.size()));
+   }
+   return !board.check(!board.color_);
+}
+
+bool
+Bitbases::encode(const ChessBoard& board, std::string& signature, size_t& idx) const {
+   std::array<std::array<std::pair<size_t, unsigned char>, BITBASE_MAX_FIGURES>, 2> figures;
+   std::array<unsigned, 2> sizes = {0, 0};
+   Pos pos;
+   for ( pos.row = 0; pos.row < NUMBER_OF_ROWS; pos.row++ ) {
+      for ( pos.col = 0; pos.col < NUMBER_OF_COLS; pos.col++ ) {
+         const auto sq = board.getSquareUnsafe(pos);
+         if ( !sq.empty() && sq.figure() != ChessFigure::King ) {
+            if ( sizes[sq.color()] == BITBASE_MAX_FIGURES ) {
+               return false;
+            }
+            figures[sq.color()][sizes[sq.color()]++] = std::make_pair(BITBASE_FIGURE_ORDER.find(toChar(true, sq.figure())), pos.code());
+         }
+      }
+   }
+   const bool strong = sizes[BLACK] ? BLACK : WHITE;
+   if ( sizes[!strong] ) {
+      return false;
+   }
+   auto& own = figures[strong];
+   std::sort(own.begin(), own.begin() + sizes[strong]);
+   const unsigned char mirror = strong ? 0 : 56;
+   signature = "K";
+   idx = board.color_ == strong;
+   unsigned shift = 1;
+   idx |= size_t(board.kings_[strong].code() ^ mirror) << shift;
+   for ( unsigned i = 0; i < sizes[strong]; i++ ) {
+      signature += BITBASE_FIGURE_ORDER[own[i].first];
+      shift += 6;
+      idx |= size_t(own[i].second ^ mirror) << shift;
+   }
+   signature += "K";
+   shift += 6;
+   idx |= size_t(board.kings_[!strong].code() ^ mirror) << shift;
+   return true;
+}
+
+unsigned char
+Bitbases::lookup(const ChessBoard& board) const {
+   std::string signature;
+   size_t idx;
+   if ( !encode(board, signature, idx) ) {
+      return BITBASE_ILLEGAL;
+   }
+   if ( isTrivialDraw(signature) ) {
+      return BITBASE_DRAW;
+   }
+   auto it = tables_.find(signature);
+   return it == tables_.end() ? BITBASE_ILLEGAL : get(it->second.data, idx);
+}
+
+bool
+Bitbases::probe(const ChessBoard& board, int& result) const {
+   const auto value = lookup(board);
+   if ( value == BITBASE_ILLEGAL ) {
+      return false;
+   }
+   result = value == BITBASE_WIN ? +1 : ( value == BITBASE_LOSS ? -1 : 0 );
+   return true;
+}
+
+bool
+Bitbases::generate(const std::string& sig) {
+   const std::string signature = canonical(sig);
+   if ( signature.empty() ) {
+      return false;
+   }
+   if ( isTrivialDraw(signature) || has(signature) ) {
+      return true;
+   }
+   // smaller tables first: the lone king captures a figure or a pawn promotes
+   for ( size_t i = 1; i + 1 < signature.size(); i++ ) {
+      std::string sub = signature;
+      if ( !generate(sub.erase(i, 1)) ) {
+         return false;
+      }
+      for ( size_t j = 0; signature[i] == 'P' && j + 1 < BITBASE_FIGURE_ORDER.size(); j++ ) {
+         sub = signature;
+         sub[i] = BITBASE_FIGURE_ORDER[j];
+         if ( !generate(sub) ) {
+            return false;
+         }
+      }
+   }
+
+   // forward pass: count the moves staying in this table, settle what the smaller tables already tell
+   const size_t entries = tableSize(signature);
+   std::vector<unsigned char> values(entries, BITBASE_DRAW);
+   std::vector<unsigned char> counters(entries, 0);
+   std::vector<std::uint32_t> queue;
+   ChessBoard board;
+   ChessMoveVector moves;
+   for ( size_t idx = 0; idx < entries; idx++ ) {
+      std::string nextSignature;
+      size_t nextIdx;
+      if ( !decode(signature, idx, board) || !encode(board, nextSignature, nextIdx) || nextIdx != idx ) {
+         values[idx] = BITBASE_ILLEGAL; // or a twin of a canonical position with the same figures swapped
+         continue;
+      }
+      board.listMoves(moves);
+      bool blocked = false;
+      for ( const auto& move : moves ) {
+         ChessBoard next = board;
+         next.applyMove(move.from, move.to, move.promoteTo);
+         encode(next, nextSignature, nextIdx);
+         const auto value = nextSignature == signature ? BITBASE_WIN : lookup(next);
+         if ( value == BITBASE_LOSS ) {
+            values[idx] = BITBASE_WIN;
+            break;
+         }
+         blocked = blocked || value != BITBASE_WIN;
+         counters[idx] += nextSignature == signature;
+      }
+      if ( values[idx] == BITBASE_DRAW && !counters[idx] ) {
+         values[idx] = blocked || ( moves.empty() && !board.check(board.color_) ) ? BITBASE_STALEMATE : BITBASE_LOSS;
+      }
+      if ( blocked ) {
+         counters[idx] = 0; // cannot be lost anymore
+      }
+      if ( values[idx] == BITBASE_WIN || values[idx] == BITBASE_LOSS ) {
+         queue.push_back(idx);
+      }
+   }
+
+   // backward pass: the predecessor of a lost position is won, the one with only won successors is lost
+   std::vector<size_t> predecessors;
+   for ( size_t i = 0; i < queue.size(); i++ ) {
+      decode(signature, queue[i], board);
+      const bool lost = values[queue[i]] == BITBASE_LOSS;
+      listPredecessors(board, predecessors);
+      for ( const auto& idx : predecessors ) {
+         if ( values[idx] != BITBASE_DRAW ) {
+            continue;
+         }
+         if ( lost ) {
+            values[idx] = BITBASE_WIN;
+            queue.push_back(idx);
+         } else if ( counters[idx] && !--counters[idx] ) {
+            values[idx] = BITBASE_LOSS;
+            queue.push_back(idx);
+         }
+      }
+   }
+
+   auto& table = tables_[signature];
+   table.storage.assign((entries + 3) / 4, 0);
+   for ( size_t idx = 0; idx < entries; idx++ ) {
+      table.storage[idx >> 2] |= (values[idx] & 3) << ((idx & 3) << 1);
+   }
+   table.data = table.storage.data();
+   table.entries = entries;
+   return true;
+}
+
+void
+Bitbases::listPredecessors(const ChessBoard& board, std::vector<size_t>& predecessors) const {
+   predecessors.clear();
+   const bool mover = !board.color_;
+   std::string signature;
+   size_t idx;
+   auto unmove = [&](const Pos& from, const Pos& to) {
+      ChessBoard prev = board;
+      prev.set(to, board.getSquareUnsafe(from));
+      prev.set(from, ChessSquare());
+      prev.color_ = mover;
+      encode(prev, signature, idx);
+      predecessors.push_back(idx);
+   };
+   Pos from;
+   for ( from.row = 0; from.row < NUMBER_OF_ROWS; from.row++ ) {
+      for ( from.col = 0; from.col < NUMBER_OF_COLS; from.col++ ) {
+         const auto sq = board.getSquareUnsafe(from);
+         if ( sq.empty() || sq.color() != mover ) {
+            continue;
+         }
+         const auto sfig = sq.figure();
+         if ( sfig == ChessFigure::Pawn ) { // the figures are always white
+            const Pos to = from.add(Pos(-1, 0));
+            if ( to.row >= FIRST_PAWN_ROW && board.isEmpty(to) ) {
+               unmove(from, to);
+               if ( to.row == FIRST_PAWN_ROW + 1 && board.isEmpty(to.add(Pos(-1, 0))) ) {
+                  unmove(from, to.add(Pos(-1, 0)));
+               }
+            }
+         } else if ( sfig == ChessFigure::Knight ) {
+            Pos kpos = from.add(KNIGHT_FIRST_DIR);
+            Pos kshift = KNIGHT_FIRST_SHIFT;
+            for ( size_t i = 0; i < 8; i ++ ) {
+               if ( kpos.valid() && board.isEmpty(kpos) ) {
+                  unmove(from, kpos);
+               }
+               kpos.move(kshift);
+               kshift.knightShiftRot();
+            }
+         } else {
+            Pos dir;
+            for ( dir.row = -1; dir.row <= +1; dir.row++ ) {
+               for ( dir.col = -1; dir.col <= +1; dir.col++ ) {
+                  if ( dir.null() || sfig == ( dir.isAxialDir() ? ChessFigure::Bishop : ChessFigure::Rook ) ) {
+                     continue;
+                  }
+                  for ( Pos to = from.add(dir); to.valid() && board.isEmpty(to); to.move(dir) ) {
+                     unmove(from, to);
+                     if ( sfig == ChessFigure::King ) {
+                        break;
+                     }
+                  }
+               }
+            }
+         }
+      }
+   }
+}
+
+bool
+Bitbases::load(const std::string& fname) {
+   if ( mapping_ ) {
+      return false;
+   }
+   int fd = open(fname.c_str(), O_RDONLY);
+   if ( fd < 0 ) {
+      return false;
+   }
+   struct stat st;
+   void* mapping = MAP_FAILED;
+   if ( fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(BitbaseHeader) ) {
+      mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   }
+   close(fd);
+   if ( mapping == MAP_FAILED ) {
+      return false;
+   }
+   const size_t size = st.st_size;
+   const auto* bytes = static_cast<const unsigned char*>(mapping);
+   BitbaseHeader header;
+   memcpy(&header, bytes, sizeof(header));
+   bool valid = BITBASE_MAGIC.compare(0, BITBASE_SIGNATURE_SIZE, header.magic) == 0 && header.version == BITBASE_VERSION
+             && sizeof(header) + header.count * sizeof(BitbaseEntry) <= size;
+   std::map<std::string, Table> tables;
+   for ( unsigned i = 0; valid && i < header.count; i++ ) {
+      BitbaseEntry entry;
+      memcpy(&entry, bytes + sizeof(header) + i * sizeof(entry), sizeof(entry));
+      const std::string signature(entry.signature, strnlen(entry.signature, BITBASE_SIGNATURE_SIZE));
+      valid = canonical(signature) == signature && entry.size == (tableSize(signature) + 3) / 4 && entry.offset + entry.size <= size;
+      if ( valid ) {
+         auto& table = tables[signature];
+         table.data = bytes + entry.offset;
+         table.entries = tableSize(signature);
+      }
+   }
+   if ( !valid ) {
+      munmap(mapping, size);
+      return false;
+   }
+   mapping_ = mapping;
+   mappingSize_ = size;
+   for ( auto& elem : tables ) {
+      if ( !has(elem.first) ) {
+         tables_[elem.first] = std::move(elem.second);
+      }
+   }
+   return true;
+}
+
+bool
+Bitbases::save(const std::string& fname) const {
+   const std::string tmpName = fname + ".tmp";
+   {
+      std::ofstream ofs(tmpName, std::ios::binary | std::ios::trunc);
+      BitbaseHeader header;
+      memset(&header, 0, sizeof(header));
+      BITBASE_MAGIC.copy(header.magic, BITBASE_SIGNATURE_SIZE);
+      header.version = BITBASE_VERSION;
+      header.count = tables_.size();
+      ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      std::uint64_t offset = sizeof(header) + tables_.size() * sizeof(BitbaseEntry);
+      for ( const auto& elem : tables_ ) {
+         BitbaseEntry entry;
+         memset(&entry, 0, sizeof(entry));
+         elem.first.copy(entry.signature, BITBASE_SIGNATURE_SIZE);
+         entry.offset = offset;
+         entry.size = (elem.second.entries + 3) / 4;
+         offset += entry.size;
+         ofs.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+      }
+      for ( const auto& elem : tables_ ) {
+         ofs.write(reinterpret_cast<const char*>(elem.second.data), (elem.second.entries + 3) / 4);
+      }
+      if ( !ofs ) {
+         return false;
+      }
+   }
+   return std::rename(tmpName.c_str(), fname.c_str()) == 0;
+}
+
+bool
+Bitbases::init(const std::string& fname, const std::vector<std::string>& signatures) {
+   load(fname);
+   bool dirty = false;
+   for ( const auto& elem : signatures ) {
+      const auto signature = canonical(elem);
+      if ( signature.empty() ) {
+         return false;
+      }
+      if ( !isTrivialDraw(signature) && !has(signature) ) {
+         if ( !generate(signature) ) {
+            return false;
+         }
+         dirty = true;
+      }
+   }
+   return !dirty || save(fname);
+}
+
+std::vector<std::string>
+Bitbases::signatures() const {
+   std::vector<std::string> retval;
+   for ( const auto& elem : tables_ ) {
+      retval.push_back(elem.first);
+   }
+   return retval;
+}
+
+void
+Bitbases::countResults(const std::string& signature, std::array<unsigned long, 4>& counts) const {
+   counts.fill(0);
+   auto it = tables_.find(canonical(signature));
+   if ( it != tables_.end() ) {
+      for ( size_t idx = 0; idx < it->second.entries; idx++ ) {
+         counts[get(it->second.data, idx)]++;
+      }
+   }
+}
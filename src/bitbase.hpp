@@ -0,0 +1,62 @@
+#ifndef BITBASE_H
+#define BITBASE_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "primitives.hpp"
+
+constexpr unsigned BITBASE_VERSION = 1;
+constexpr unsigned BITBASE_MAX_FIGURES = 2;
+constexpr unsigned BITBASE_SIGNATURE_SIZE = 8;
+constexpr unsigned char BITBASE_DRAW = 0; // also unknown while generating
+constexpr unsigned char BITBASE_WIN = 1;
+constexpr unsigned char BITBASE_LOSS = 2;
+constexpr unsigned char BITBASE_ILLEGAL = 3;
+const std::string BITBASE_MAGIC = "OMICEBB";
+const std::string BITBASE_FIGURE_ORDER = "QRBNP";
+const std::string BITBASE_FILE = "omice.bb";
+
+// Win/draw/loss tables for a lone king against a king and a few figures, made by retrograde analysis.
+// Signature is like "KRK" or "KBNK", the position is always seen from the side owning the figures.
+class Bitbases {
+public:
+   Bitbases() {}
+   Bitbases(const Bitbases&) = delete;
+   Bitbases& operator=(const Bitbases&) = delete;
+   ~Bitbases();
+
+   bool load(const std::string& fname);
+   bool save(const std::string& fname) const;
+   bool init(const std::string& fname, const std::vector<std::string>& signatures);
+   bool generate(const std::string& signature);
+   bool has(const std::string& signature) const { return tables_.count(signature); }
+   std::vector<std::string> signatures() const;
+   void countResults(const std::string& signature, std::array<unsigned long, 4>& counts) const;
+
+   // result is for the side to move: +1 win, 0 draw, -1 loss
+   bool probe(const ChessBoard& board, int& result) const;
+
+   static std::string canonical(const std::string& signature);
+
+private:
+   struct Table {
+      const unsigned char* data = nullptr;
+      size_t entries = 0;
+      std::vector<unsigned char> storage;
+   };
+   static bool isTrivialDraw(const std::string& signature) { return signature.size() <= 2 || signature == "KBK" || signature == "KNK"; }
+   static size_t tableSize(const std::string& signature) { return size_t(2) << (6 * (signature.size())); }
+   static unsigned char get(const unsigned char* data, size_t idx) { return (data[idx >> 2] >> ((idx & 3) << 1)) & 3; }
+   bool decode(const std::string& signature, size_t idx, ChessBoard& board) const;
+   bool encode(const ChessBoard& board, std::string& signature, size_t& idx) const;
+   unsigned char lookup(const ChessBoard& board) const;
+   void listPredecessors(const ChessBoard& board, std::vector<size_t>& predecessors) const;
+
+   std::map<std::string, Table> tables_;
+   void* mapping_ = nullptr;
+   size_t mappingSize_ = 0;
+};
+
+#endif /* BITBASE_H */
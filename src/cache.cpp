@@ -0,0 +1,280 @@
+#include "cache.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "search.hpp"
+
+struct CacheHeader {
+   char magic[8];
+   std::uint32_t version;
+   std::uint32_t reserved;
+};
+
+struct CacheRecord {
+   std::uint64_t key;
+   std::uint8_t squares[NUMBER_OF_ROWS * NUMBER_OF_COLS / 2];
+   std::uint8_t color;
+   char enpassant;
+   char casts[NUMBER_OF_CASTS];
+   std::uint8_t lineSize;
+   std::uint8_t line[CACHE_LINE_PLIES][3]; // from, to, promotion
+   std::uint32_t analysisVersion;
+   std::uint32_t visits;
+   std::uint32_t bestVisits;
+   std::uint32_t iterations;
+   std::uint32_t milliseconds;
+   float bestScore;
+   float value;
+   char engine[8];
+};
+
+static void
+packBoard(const ChessBoard& board, CacheRecord& rec) {
+   for ( int row = 0; row < NUMBER_OF_ROWS; row++ ) {
+      for ( int i = 0; i < NUMBER_OF_COLS / 2; i++ ) {
+         rec.squares[row * NUMBER_OF_COLS / 2 + i] = board.getSquareUnsafe(Pos(row, 2 * i)).data() | board.getSquareUnsafe(Pos(row, 2 * i + 1)).data() << 4;
+      }
+   }
+   rec.color = board.color_;
+   rec.enpassant = board.enpassant_;
+   memcpy(rec.casts, board.casts_.data(), NUMBER_OF_CASTS);
+}
+
+// the clocks are left out, the analysis of a position does not depend on them much
+static bool
+sameBoard(const ChessBoard& board, const CacheRecord& rec) {
+   CacheRecord packed;
+   packBoard(board, packed);
+   return memcmp(packed.squares, rec.squares, sizeof(rec.squares)) == 0 && packed.color == rec.color
+       && packed.enpassant == rec.enpassant && memcmp(packed.casts, rec.casts, NUMBER_OF_CASTS) == 0;
+}
+
+static CacheHeader
+currentHeader() {
+   CacheHeader header;
+   memset(&header, 0, sizeof(header));
+   CACHE_MAGIC.copy(header.magic, sizeof(header.magic));
+   header.version = CACHE_VERSION;
+   return header;
+}
+
+static bool
+readable(const CacheHeader& header) {
+   return CACHE_MAGIC.compare(0, sizeof(header.magic), header.magic, strnlen(header.magic, sizeof(header.magic))) == 0 && header.version == CACHE_VERSION;
+}
+
+static bool
+current(const CacheRecord& rec) {
+   return rec.analysisVersion == ANALYSIS_VERSION && ENGINE_NAME.compare(0, sizeof(rec.engine), rec.engine, strnlen(rec.engine, sizeof(rec.engine))) == 0;
+}
+
+bool
+AnalysisCache::open(const std::string& fname, size_t megabytes) {
+   close();
+   std::lock_guard<std::mutex> lock(mutex_);
+   fname_ = fname;
+   limit_ = megabytes << 20;
+   fd_ = ::open(fname.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+   if ( fd_ < 0 ) {
+      return false;
+   }
+   struct stat st;
+   if ( fstat(fd_, &st) != 0 ) {
+      return false;
+   }
+   CacheHeader header;
+   if ( size_t(st.st_size) < sizeof(CacheHeader) || pread(fd_, &header, sizeof(header), 0) != ssize_t(sizeof(header)) || !readable(header) ) {
+      // empty, cut short in its header or written by another version, the records can't be read so it starts over
+      header = currentHeader();
+      if ( ftruncate(fd_, 0) != 0 || write(fd_, &header, sizeof(header)) != ssize_t(sizeof(header)) ) {
+         return false;
+      }
+   } else if ( ( st.st_size - sizeof(CacheHeader) ) % sizeof(CacheRecord) ) {
+      // a record cut short by a crash, the next ones have to stay aligned
+      if ( ftruncate(fd_, st.st_size - ( st.st_size - sizeof(CacheHeader) ) % sizeof(CacheRecord)) != 0 ) {
+         return false;
+      }
+   }
+   return map();
+}
+
+void
+AnalysisCache::close() {
+   std::lock_guard<std::mutex> lock(mutex_);
+   if ( mapping_ ) {
+      munmap(mapping_, mappingSize_);
+      mapping_ = nullptr;
+   }
+   if ( fd_ >= 0 ) {
+      ::close(fd_);
+      fd_ = -1;
+   }
+   mapped_ = 0;
+   appended_.clear();
+   index_.clear();
+}
+
+bool
+AnalysisCache::map() {
+   if ( mapping_ ) {
+      munmap(mapping_, mappingSize_);
+      mapping_ = nullptr;
+   }
+   mapped_ = 0;
+   appended_.clear();
+   index_.clear();
+   struct stat st;
+   if ( fstat(fd_, &st) != 0 || size_t(st.st_size) < sizeof(CacheHeader) ) {
+      return false;
+   }
+   void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd_, 0);
+   if ( mapping == MAP_FAILED ) {
+      return false;
+   }
+   mapping_ = mapping;
+   mappingSize_ = st.st_size;
+   CacheHeader header;
+   memcpy(&header, mapping_, sizeof(header));
+   if ( !readable(header) ) {
+      return false;
+   }
+   mapped_ = ( mappingSize_ - sizeof(CacheHeader) ) / sizeof(CacheRecord);
+   for ( size_t i = 0; i < mapped_; i++ ) {
+      CacheRecord rec;
+      memcpy(&rec, record(i), sizeof(rec));
+      index_[rec.key] = i;
+   }
+   return true;
+}
+
+const unsigned char*
+AnalysisCache::record(size_t i) const {
+   return i < mapped_
+      ? static_cast<const unsigned char*>(mapping_) + sizeof(CacheHeader) + i * sizeof(CacheRecord)
+      : appended_.data() + ( i - mapped_ ) * sizeof(CacheRecord);
+}
+
+bool
+AnalysisCache::find(const ChessBoard& board, Analysis& analysis) const {
+   std::lock_guard<std::mutex> lock(mutex_);
+   const auto it = index_.find(board.hash());
+   if ( it == index_.end() ) {
+      return false;
+   }
+   CacheRecord rec;
+   memcpy(&rec, record(it->second), sizeof(rec));
+   if ( !current(rec) || !sameBoard(board, rec) ) {
+      return false;
+   }
+   analysis.line.clear();
+   for ( unsigned i = 0; i < rec.lineSize && i < CACHE_LINE_PLIES; i++ ) {
+      analysis.line.push_back(ChessMove(PosFromCode(rec.line[i][0]), PosFromCode(rec.line[i][1]), ChessFigure(rec.line[i][2])));
+   }
+   analysis.bestScore = rec.bestScore;
+   analysis.value = rec.value;
+   analysis.visits = rec.visits;
+   analysis.bestVisits = rec.bestVisits;
+   analysis.iterations = rec.iterations;
+   analysis.milliseconds = rec.milliseconds;
+   return true;
+}
+
+bool
+AnalysisCache::store(const ChessBoard& board, const Analysis& analysis) {
+   std::lock_guard<std::mutex> lock(mutex_);
+   if ( fd_ < 0 || !mapping_ ) {
+      return false;
+   }
+   if ( sizeof(CacheHeader) + ( mapped_ * sizeof(CacheRecord) + appended_.size() ) + sizeof(CacheRecord) > limit_ && !compact(limit_ * 3 / 4) ) {
+      return false;
+   }
+   CacheRecord rec;
+   memset(&rec, 0, sizeof(rec));
+   rec.key = board.hash();
+   packBoard(board, rec);
+   rec.lineSize = std::min<size_t>(analysis.line.size(), CACHE_LINE_PLIES);
+   for ( unsigned i = 0; i < rec.lineSize; i++ ) {
+      rec.line[i][0] = analysis.line[i].from.code();
+      rec.line[i][1] = analysis.line[i].to.code();
+      rec.line[i][2] = static_cast<std::uint8_t>(analysis.line[i].promoteTo);
+   }
+   rec.analysisVersion = ANALYSIS_VERSION;
+   rec.visits = analysis.visits;
+   rec.bestVisits = analysis.bestVisits;
+   rec.iterations = analysis.iterations;
+   rec.milliseconds = analysis.milliseconds;
+   rec.bestScore = analysis.bestScore;
+   rec.value = analysis.value;
+   ENGINE_NAME.copy(rec.engine, sizeof(rec.engine));
+   if ( write(fd_, &rec, sizeof(rec)) != ssize_t(sizeof(rec)) ) {
+      return false;
+   }
+   const auto* bytes = reinterpret_cast<const unsigned char*>(&rec);
+   index_[rec.key] = mapped_ + appended_.size() / sizeof(CacheRecord);
+   appended_.insert(appended_.end(), bytes, bytes + sizeof(rec));
+   return true;
+}
+
+bool
+AnalysisCache::compact() {
+   std::lock_guard<std::mutex> lock(mutex_);
+   return fd_ >= 0 && mapping_ && compact(limit_);
+}
+
+bool
+AnalysisCache::compact(size_t limit) {
+   // the last record of every position, if it is still current
+   std::vector<CacheRecord> kept;
+   for ( const auto& elem : index_ ) {
+      CacheRecord rec;
+      memcpy(&rec, record(elem.second), sizeof(rec));
+      if ( current(rec) ) {
+         kept.push_back(rec);
+      }
+   }
+   const size_t fits = limit > sizeof(CacheHeader) ? ( limit - sizeof(CacheHeader) ) / sizeof(CacheRecord) : 0;
+   if ( kept.size() > fits ) {
+      std::nth_element(kept.begin(), kept.begin() + fits, kept.end(), [](const CacheRecord& lhs, const CacheRecord& rhs) { return lhs.iterations > rhs.iterations; });
+      kept.resize(fits);
+   }
+   const std::string tmpName = fname_ + ".tmp";
+   const int fd = ::open(tmpName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if ( fd < 0 ) {
+      return false;
+   }
+   const CacheHeader header = currentHeader();
+   bool valid = write(fd, &header, sizeof(header)) == ssize_t(sizeof(header));
+   if ( valid && !kept.empty() ) {
+      valid = write(fd, kept.data(), kept.size() * sizeof(CacheRecord)) == ssize_t(kept.size() * sizeof(CacheRecord));
+   }
+   valid = ::close(fd) == 0 && valid;
+   if ( !valid || std::rename(tmpName.c_str(), fname_.c_str()) != 0 ) {
+      return false;
+   }
+   const int next = ::open(fname_.c_str(), O_RDWR | O_APPEND);
+   if ( next < 0 ) {
+      return false;
+   }
+   ::close(fd_);
+   fd_ = next;
+   return map();
+}
+
+size_t
+AnalysisCache::positions() const {
+   std::lock_guard<std::mutex> lock(mutex_);
+   return index_.size();
+}
+
+size_t
+AnalysisCache::records() const {
+   std::lock_guard<std::mutex> lock(mutex_);
+   return mapped_ + appended_.size() / sizeof(CacheRecord);
+}
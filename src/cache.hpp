@@ -0,0 +1,63 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "primitives.hpp"
+
+constexpr unsigned CACHE_VERSION = 2;
+constexpr unsigned ANALYSIS_VERSION = 1; // raise when the search changes, older analyses are not used any more
+constexpr unsigned CACHE_LINE_PLIES = 8;
+constexpr size_t DEFAULT_CACHE_MB = 64;
+const std::string CACHE_MAGIC = "OMICEAC";
+
+// What a search found out about a position.
+struct Analysis {
+   ChessMoveVector line; // starts with the best move
+   double bestScore = 0.5; // of the best move for the side to move
+   unsigned bestVisits = 0;
+   double value = 0.5; // of the position for the side that moved into it
+   unsigned visits = 0;
+   unsigned long iterations = 0;
+   unsigned milliseconds = 0;
+};
+
+// Append-only file of analyses keyed by the position hash, read through a mapping.
+// The position is stored next to the key, a colliding hash is a miss. The last record of a position wins.
+// When the file would grow over its limit it is compacted to the last current record of every position,
+// and if that is still too much only the best searched records are kept.
+class AnalysisCache {
+public:
+   AnalysisCache() {}
+   AnalysisCache(const AnalysisCache&) = delete;
+   AnalysisCache& operator=(const AnalysisCache&) = delete;
+   ~AnalysisCache() { close(); }
+
+   bool open(const std::string& fname, size_t megabytes = DEFAULT_CACHE_MB);
+   void close();
+   bool find(const ChessBoard& board, Analysis& analysis) const;
+   bool store(const ChessBoard& board, const Analysis& analysis);
+   bool compact();
+   size_t positions() const;
+   size_t records() const;
+
+private:
+   const unsigned char* record(size_t i) const;
+   bool map();
+   bool compact(size_t limit);
+
+   std::string fname_;
+   size_t limit_ = 0;
+   int fd_ = -1;
+   void* mapping_ = nullptr;
+   size_t mappingSize_ = 0;
+   size_t mapped_ = 0; // records in the mapping
+   std::vector<unsigned char> appended_; // records written since
+   std::unordered_map<unsigned long long, size_t> index_;
+   mutable std::mutex mutex_;
+};
+
+#endif /* CACHE_H */
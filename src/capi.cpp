@@ -0,0 +1,229 @@
+#include "omice.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#include "primitives.hpp"
+#include "uci.hpp"
+
+static_assert(int(ChessFigure::Knight) == OMICE_KNIGHT && int(ChessFigure::Queen) == OMICE_QUEEN, "the promotion codes are the figures");
+
+// offsets of omice_board, see omice.h
+constexpr unsigned BOARD_SIDE = NUMBER_OF_SQUARES / 2;
+constexpr unsigned BOARD_CASTS = BOARD_SIDE + 1;
+constexpr unsigned BOARD_ENPASSANT = BOARD_CASTS + NUMBER_OF_CASTS;
+constexpr unsigned BOARD_CLOCKS = BOARD_ENPASSANT + 1;
+constexpr unsigned BOARD_FORMAT = sizeof(omice_board) - 1;
+constexpr unsigned char BOARD_NO_COLUMN = 255;
+
+static void
+pack(const ChessBoard& board, omice_board& packed) {
+   memset(packed.data, 0, sizeof(packed.data));
+   if ( !board.valid() ) {
+      return;
+   }
+   for ( unsigned sq = 0; sq < NUMBER_OF_SQUARES; sq++ ) {
+      const auto psq = board.getSquareUnsafe(PosFromCode(sq));
+      if ( !psq.empty() ) {
+         packed.data[sq / 2] |= ( unsigned(psq.figure()) * 2 + psq.color() ) << ( sq % 2 * 4 );
+      }
+   }
+   packed.data[BOARD_SIDE] = board.color_;
+   for ( unsigned i = 0; i < NUMBER_OF_CASTS; i++ ) {
+      packed.data[BOARD_CASTS + i] = board.casts_[i] == CHAR_INVALID ? BOARD_NO_COLUMN : toupper(board.casts_[i]) - 'A';
+   }
+   packed.data[BOARD_ENPASSANT] = board.hasEnpassantCapture() ? board.enpassant_ - 'a' : BOARD_NO_COLUMN;
+   packed.data[BOARD_CLOCKS + HALF_CLOCK] = board.clocks_[HALF_CLOCK];
+   packed.data[BOARD_CLOCKS + FULL_CLOCK] = board.clocks_[FULL_CLOCK];
+   packed.data[BOARD_FORMAT] = OMICE_BOARD_FORMAT;
+}
+
+// rebuilds the board from arbitrary bytes, false if they are not a position pack could have written
+static bool
+unpack(const omice_board& packed, ChessBoard& board) {
+   const unsigned char* data = packed.data;
+   if ( data[BOARD_FORMAT] != OMICE_BOARD_FORMAT || data[BOARD_SIDE] > 1 ) {
+      return false;
+   }
+   for ( unsigned i = BOARD_CLOCKS + NUMBER_OF_CLOCKS; i < BOARD_FORMAT; i++ ) {
+      if ( data[i] ) {
+         return false;
+      }
+   }
+   board = ChessBoard();
+   for ( unsigned sq = 0; sq < NUMBER_OF_SQUARES; sq++ ) {
+      const unsigned nibble = ( data[sq / 2] >> ( sq % 2 * 4 ) ) & 15;
+      if ( nibble == 1 || nibble / 2 > unsigned(ChessFigure::King) ) {
+         return false;
+      }
+      if ( nibble ) {
+         board.set(PosFromCode(sq), ChessSquare(ChessFigure(nibble / 2), nibble & 1));
+      }
+   }
+   board.color_ = data[BOARD_SIDE];
+   for ( unsigned i = 0; i < NUMBER_OF_CASTS; i++ ) {
+      const unsigned char col = data[BOARD_CASTS + i];
+      const bool color = i < CASTS_SIDES;
+      if ( col == BOARD_NO_COLUMN ) {
+         continue;
+      }
+      // the long side left of the king, the short one right of it
+      if ( col >= NUMBER_OF_COLS || !board.kings_[color].valid() || ( col > board.kings_[color].col ) != bool(i % CASTS_SIDES) ) {
+         return false;
+      }
+      board.casts_[i] = color ? 'A' + col : 'a' + col;
+   }
+   const unsigned char col = data[BOARD_ENPASSANT];
+   if ( col != BOARD_NO_COLUMN ) {
+      // the target and the square the pawn came from are empty, the pawn stands between them
+      const int dir = board.color_ ? -1 : +1;
+      const Pos to(board.color_ ? LAST_EMP_ROW : FIRST_EMP_ROW, col);
+      if ( col >= NUMBER_OF_COLS || !board.isEmpty(to) || !board.isEmpty(Pos(to.row - dir, col))
+         || !( board.getSquareUnsafe(Pos(to.row + dir, col)) == ChessSquare(ChessFigure::Pawn, !board.color_) ) ) {
+         return false;
+      }
+      board.enpassant_ = 'a' + col;
+   }
+   board.clocks_[HALF_CLOCK] = data[BOARD_CLOCKS + HALF_CLOCK];
+   board.clocks_[FULL_CLOCK] = data[BOARD_CLOCKS + FULL_CLOCK];
+   return board.validHeavy();
+}
+
+extern "C" {
+
+__attribute__((visibility("default"))) int
+omice_abi_version(void) {
+   return OMICE_ABI_VERSION;
+}
+
+__attribute__((visibility("default"))) size_t
+omice_load(const char* const* fens, size_t n, omice_board* boards, unsigned char* ok) {
+   size_t retval = 0;
+   for ( size_t i = 0; i < n; i++ ) {
+      ChessBoard board;
+      ok[i] = fens[i] && board.initFEN(fens[i]);
+      pack(ok[i] ? board : ChessBoard(), boards[i]);
+      // a FEN can hold what the other calls would refuse, like castling with the king off its side
+      ok[i] = ok[i] && unpack(boards[i], board);
+      if ( !ok[i] ) {
+         pack(ChessBoard(), boards[i]);
+      }
+      retval += ok[i];
+   }
+   return retval;
+}
+
+__attribute__((visibility("default"))) size_t
+omice_validate(const char* const* fens, const char* const* moves, size_t n, signed char* results) {
+   size_t retval = 0;
+   ChessMoveArray legal;
+   for ( size_t i = 0; i < n; i++ ) {
+      ChessBoard board;
+      ChessMove move;
+      if ( !fens[i] || !board.initFEN(fens[i]) ) {
+         results[i] = OMICE_BAD_FEN;
+      } else if ( !moves[i] || !Uci::parseMove(board, std::string(moves[i], strnlen(moves[i], 5)), move) ) {
+         // a move is read from its first five characters at most, these fit the string without allocating
+         results[i] = OMICE_BAD_MOVE;
+      } else {
+         board.listMoves(legal);
+         if ( legal.overflow() ) {
+            results[i] = OMICE_BAD_FEN;
+         } else {
+            results[i] = std::find(legal.begin(), legal.end(), move) != legal.end() ? OMICE_LEGAL : OMICE_ILLEGAL;
+         }
+      }
+      retval += results[i] == OMICE_LEGAL;
+   }
+   return retval;
+}
+
+__attribute__((visibility("default"))) size_t
+omice_list_moves(const omice_board* boards, size_t n, omice_move* out, size_t capacity, size_t* offsets) {
+   size_t size = 0;
+   ChessMoveArray legal;
+   for ( size_t i = 0; i < n; i++ ) {
+      offsets[i] = size;
+      ChessBoard board;
+      if ( !unpack(boards[i], board) ) {
+         continue;
+      }
+      board.listMoves(legal);
+      if ( legal.overflow() ) {
+         continue;
+      }
+      if ( size + legal.size() > capacity ) {
+         return size_t(-1);
+      }
+      for ( const auto& move : legal ) {
+         out[size++] = omice_move{move.from.code(), move.to.code(), static_cast<unsigned char>(move.promoteTo), 0};
+      }
+   }
+   offsets[n] = size;
+   return size;
+}
+
+__attribute__((visibility("default"))) size_t
+omice_list_mobile(const omice_board* boards, size_t n, unsigned char* out, size_t capacity, size_t* offsets) {
+   size_t size = 0;
+   ChessMoveArray legal;
+   for ( size_t i = 0; i < n; i++ ) {
+      offsets[i] = size;
+      ChessBoard board;
+      if ( !unpack(boards[i], board) ) {
+         continue;
+      }
+      MobilePieces mobile;
+      board.listMobilePieces(mobile);
+      if ( mobile.complete() ) {
+         if ( size + mobile.pawns.size() + mobile.pieces.size() > capacity ) {
+            return size_t(-1);
+         }
+         for ( const auto* vec : {&mobile.pawns, &mobile.pieces} ) {
+            for ( size_t j = 0; j < vec->size(); j++ ) {
+               out[size++] = vec->get(j);
+            }
+         }
+         continue;
+      }
+      // too many pieces for the short lists, the moves tell them too, grouped by piece
+      board.listMoves(legal);
+      if ( legal.overflow() ) {
+         continue;
+      }
+      for ( const auto& move : legal ) {
+         if ( std::find(out + offsets[i], out + size, move.from.code()) == out + size ) {
+            if ( size >= capacity ) {
+               return size_t(-1);
+            }
+            out[size++] = move.from.code();
+         }
+      }
+   }
+   offsets[n] = size;
+   return size;
+}
+
+__attribute__((visibility("default"))) size_t
+omice_apply(omice_board* boards, const omice_move* moves, size_t n, unsigned char* ok) {
+   size_t retval = 0;
+   ChessMoveArray legal;
+   for ( size_t i = 0; i < n; i++ ) {
+      ChessBoard board;
+      const ChessMove move(PosFromCode(moves[i].from & 63), PosFromCode(moves[i].to & 63), ChessFigure(moves[i].promotion <= OMICE_QUEEN ? moves[i].promotion : 0));
+      ok[i] = unpack(boards[i], board);
+      if ( ok[i] ) {
+         board.listMoves(legal);
+         ok[i] = !legal.overflow() && std::find(legal.begin(), legal.end(), move) != legal.end();
+      }
+      if ( ok[i] ) {
+         board.applyMove(move.from, move.to, move.promoteTo);
+         pack(board, boards[i]);
+      }
+      retval += ok[i];
+   }
+   return retval;
+}
+
+}
@@ -1,13 +1,653 @@
+#include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <csignal>
 #include <iostream>
 #include <fstream>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
+#include <unistd.h>
 
+#include "annotate.hpp"
+#include "batch.hpp"
+#include "bitbase.hpp"
+#include "cache.hpp"
+#include "match.hpp"
+#include "playout.hpp"
 #include "primitives.hpp"
+#include "scheduler.hpp"
+#include "search.hpp"
+#include "server.hpp"
+#include "uci.hpp"
+#include "variants.hpp"
+
+const std::vector<std::string> DEFAULT_BITBASES = {"KQK", "KRK", "KPK"};
+
+template <class Board>
+static unsigned long long
+perft(const Board& board, unsigned depth) {
+   ChessMoveVector moves;
+   board.listMoves(moves);
+   if ( depth <= 1 ) {
+      return depth ? moves.size() : 1;
+   }
+   unsigned long long retval = 0;
+   for ( const auto& move : moves ) {
+      Board next = board;
+      next.applyMove(move.from, move.to, move.promoteTo);
+      retval += perft(next, depth - 1);
+   }
+   return retval;
+}
+
+// perft stands for the copy heavy work, checking every from-to pair of the positions on the way for the query heavy one
+template <class Board>
+static void
+benchmarkLayout(const std::string& name, const std::string& fen, unsigned depth, std::ostream& os) {
+   Board board;
+   board.initFEN(fen);
+   auto t1 = std::chrono::steady_clock::now();
+   const unsigned long long nodes = perft(board, depth);
+   std::chrono::duration<double> copySpan = std::chrono::steady_clock::now() - t1;
+
+   std::vector<Board> boards = {board};
+   ChessMoveVector moves;
+   for ( unsigned i = 0; i < 2; i++ ) {
+      std::vector<Board> next;
+      for ( const auto& elem : boards ) {
+         elem.listMoves(moves);
+         for ( const auto& move : moves ) {
+            next.push_back(elem);
+            next.back().applyMove(move.from, move.to, move.promoteTo);
+         }
+      }
+      boards.insert(boards.end(), next.begin(), next.end());
+   }
+   unsigned long long checks = 0;
+   unsigned long long legal = 0;
+   t1 = std::chrono::steady_clock::now();
+   for ( const auto& elem : boards ) {
+      Pos from;
+      for ( from.row = 0; from.row < NUMBER_OF_ROWS; from.row++ ) {
+         for ( from.col = 0; from.col < NUMBER_OF_COLS; from.col++ ) {
+            const auto sq = elem.getSquareUnsafe(from);
+            if ( elem.isEmpty(from) || sq.color() != elem.color_ ) {
+               continue;
+            }
+            Pos to;
+            for ( to.row = 0; to.row < NUMBER_OF_ROWS; to.row++ ) {
+               for ( to.col = 0; to.col < NUMBER_OF_COLS; to.col++ ) {
+                  legal += !to.equals(from) && elem.isMoveValid(from, to);
+                  checks++;
+               }
+            }
+         }
+      }
+   }
+   std::chrono::duration<double> querySpan = std::chrono::steady_clock::now() - t1;
+   os << name << " bytes: " << sizeof(Board) << " perft: " << nodes << " nodes/s: " << nodes / copySpan.count()
+      << " legal: " << legal << " checks/s: " << checks / querySpan.count() << std::endl;
+}
 
 int main(int argc, char* argv[]) {
+   // PERFT MODE
+   if ( argc >= 4 && std::string(argv[1]) == "perft" ) {
+      ChessBoard board;
+      if ( !board.initFEN(argv[2]) ) {
+         std::cout << "ERROR: invalid FEN " << argv[2] << std::endl;
+         return 1;
+      }
+      if ( argc >= 5 ) {
+         ChessMoveVector moves;
+         board.listMoves(moves);
+         for ( const auto& move : moves ) {
+            ChessBoard next = board;
+            next.applyMove(move.from, move.to, move.promoteTo);
+            std::cout << move << " " << perft(next, std::stoi(argv[3]) - 1) << std::endl;
+         }
+      }
+      for ( unsigned depth = 1; depth <= unsigned(std::stoi(argv[3])); depth++ ) {
+         std::cout << "perft " << depth << " " << perft(board, depth) << std::endl;
+      }
+      return 0;
+   }
+
+   // BITBASE GENERATOR MODE
+   // the only mode generating tables, the other modes use the file if there is one and play without it otherwise
+   if ( argc >= 2 && std::string(argv[1]) == "bitbase" ) {
+      Bitbases bitbases;
+      std::vector<std::string> signatures(argv + 2, argv + argc);
+      if ( signatures.empty() ) {
+         signatures = DEFAULT_BITBASES;
+      }
+      if ( !bitbases.init(BITBASE_FILE, signatures) ) {
+         std::cout << "ERROR: cannot generate bitbases" << std::endl;
+         return 1;
+      }
+      for ( const auto& elem : bitbases.signatures() ) {
+         std::array<unsigned long, 4> counts;
+         bitbases.countResults(elem, counts);
+         std::cout << elem << " win: " << counts[BITBASE_WIN] << " draw: " << counts[BITBASE_DRAW] << " loss: " << counts[BITBASE_LOSS] << std::endl;
+      }
+      return 0;
+   }
+
+   // BOARD LAYOUT MODE
+   if ( argc >= 2 && std::string(argv[1]) == "layouts" ) {
+      const std::string fen = argc >= 3 ? argv[2] : "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+      ChessBoard board;
+      if ( !board.initFEN(fen) ) {
+         std::cout << "ERROR: invalid FEN " << fen << std::endl;
+         return 1;
+      }
+      const unsigned depth = argc >= 4 ? std::stoi(argv[3]) : 5;
+      benchmarkLayout<ChessBoardT<NibbleRows>>("nibble", fen, depth, std::cout);
+      benchmarkLayout<ChessBoardT<ByteMailbox>>("mailbox", fen, depth, std::cout);
+      benchmarkLayout<ChessBoardT<BitboardPlanes>>("bitboard", fen, depth, std::cout);
+      return 0;
+   }
+
+   // PLAYOUT MODE
+   if ( argc >= 3 && std::string(argv[1]) == "playout" ) {
+      ChessBoard board;
+      if ( !board.initFEN(argv[2]) ) {
+         std::cout << "ERROR: invalid FEN " << argv[2] << std::endl;
+         return 1;
+      }
+      Bitbases bitbases;
+      bitbases.load(BITBASE_FILE);
+      const unsigned count = argc >= 4 ? std::stoi(argv[3]) : 1000;
+      Random rng(argc >= 5 ? std::stoull(argv[4]) : 1);
+      Playout playout(&bitbases);
+      playout.setSampling(argc >= 6 && std::string(argv[5]) == "sample");
+      std::array<unsigned, 3> results = {0, 0, 0};
+      unsigned long plies = 0;
+      auto t1 = std::chrono::steady_clock::now();
+      for ( unsigned i = 0; i < count; i++ ) {
+         results[playout.run(board, rng) + 1]++;
+         plies += playout.plies();
+      }
+      std::chrono::duration<double> span = std::chrono::steady_clock::now() - t1;
+      std::cout << "white: " << results[2] << " draw: " << results[1] << " black: " << results[0] << std::endl;
+      std::cout << "plies/playout: " << double(plies) / count << " playouts/s: " << count / span.count() << std::endl;
+      return 0;
+   }
+
+   // VERIFICATION MODE
+   if ( argc >= 2 && std::string(argv[1]) == "verify" ) {
+      const unsigned games = argc >= 3 ? std::stoi(argv[2]) : 1000;
+      Random rng(argc >= 4 ? std::stoull(argv[3]) : 1);
+      const std::vector<std::string> fens = {
+         "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+         "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+         "bqnb1rkr/pp3ppp/3ppn2/2p5/5P2/P2P4/NPP1P1PP/BQ1BNRKR w HFhf - 2 9"
+      };
+      // incremental mobility against the full recompute along random games
+      unsigned long positions = 0;
+      unsigned long mismatches = 0;
+      for ( unsigned i = 0; i < games; i++ ) {
+         ChessBoard board;
+         board.initFEN(fens[i % fens.size()]);
+         std::array<ChessBoard, 2> boards;
+         std::array<MobilePieces, 2> sets;
+         ChessMoveVector moves;
+         for ( unsigned ply = 0; ply < 2 * FIFTY_MOVES_CLOCK; ply++ ) {
+            MobilePieces mobile;
+            board.listMobilePieces(mobile);
+            if ( ply >= 2 ) {
+               MobilePieces incremental;
+               board.listMobilePieces(boards[ply & 1], sets[ply & 1], incremental);
+               positions++;
+               mismatches += !incremental.pawns.equals(mobile.pawns) || !incremental.pieces.equals(mobile.pieces) || incremental.check != mobile.check;
+            }
+            boards[ply & 1] = board;
+            sets[ply & 1] = mobile;
+            board.listMoves(moves);
+            if ( moves.empty() ) {
+               break;
+            }
+            const auto& move = moves[rng.below(moves.size())];
+            board.applyMove(move.from, move.to, move.promoteTo);
+         }
+      }
+      std::cout << "mobility positions: " << positions << " mismatches: " << mismatches << std::endl;
+      unsigned long failed = mismatches;
+
+      // the control map against countWatchers square by square
+      positions = mismatches = 0;
+      for ( unsigned i = 0; i < games; i++ ) {
+         ChessBoard board;
+         board.initFEN(fens[i % fens.size()]);
+         ChessMoveVector moves;
+         for ( unsigned ply = 0; ply < 2 * FIFTY_MOVES_CLOCK; ply++ ) {
+            const SquareControl control(board);
+            Pos pos;
+            for ( pos.row = 0; pos.row < NUMBER_OF_ROWS; pos.row++ ) {
+               for ( pos.col = 0; pos.col < NUMBER_OF_COLS; pos.col++ ) {
+                  for ( auto color : COLORS ) {
+                     const unsigned char count = board.countWatchers(color, pos);
+                     mismatches += control.count(color, pos) != count || ( control.least(color, pos) == ChessFigure::None ) != !count;
+                  }
+               }
+            }
+            positions++;
+            board.listMoves(moves);
+            if ( moves.empty() ) {
+               break;
+            }
+            const auto& move = moves[rng.below(moves.size())];
+            board.applyMove(move.from, move.to, move.promoteTo);
+         }
+      }
+      std::cout << "control positions: " << positions << " mismatches: " << mismatches << std::endl;
+      failed += mismatches;
+
+      // the sampled moves against a uniform pick from the full list, by Pearson's chi-square summed over the positions
+      const unsigned SAMPLES_PER_MOVE = 50;
+      const double VERIFY_MAX_Z = 4.0; // for the total and each figure, a uniform sampler fails about one run in 5000
+      Playout playout;
+      positions = mismatches = 0;
+      unsigned long samples = 0;
+      unsigned long failures = 0;
+      unsigned long freedom = 0;
+      double chi2 = 0;
+      // the same sum split by the moving figure, a bias of one kind of move hides in the total
+      std::array<double, 7> bucketChi2 {};
+      std::array<double, 7> bucketFreedom {};
+      for ( unsigned i = 0; i < games; i++ ) {
+         ChessBoard board;
+         board.initFEN(fens[i % fens.size()]);
+         ChessMoveVector moves;
+         for ( unsigned ply = 0; ply < 2 * FIFTY_MOVES_CLOCK; ply++ ) {
+            board.listMoves(moves);
+            if ( moves.empty() ) {
+               break;
+            }
+            if ( ply % 10 == i % 10 && moves.size() > 1 ) {
+               positions++;
+               std::vector<unsigned> counts(moves.size());
+               unsigned drawn = 0;
+               for ( unsigned j = 0; j < SAMPLES_PER_MOVE * moves.size(); j++ ) {
+                  ChessMove move;
+                  if ( !playout.sample(board, rng, move) ) {
+                     failures++;
+                     continue;
+                  }
+                  const auto it = std::find(moves.begin(), moves.end(), move);
+                  if ( it == moves.end() ) {
+                     mismatches++;
+                     continue;
+                  }
+                  counts[it - moves.begin()]++;
+                  drawn++;
+               }
+               const double expected = double(drawn) / moves.size();
+               for ( size_t j = 0; j < moves.size(); j++ ) {
+                  const double term = ( counts[j] - expected ) * ( counts[j] - expected ) / expected;
+                  const int bucket = int(board.getSquare(moves[j].from).figure());
+                  chi2 += term;
+                  bucketChi2[bucket] += term;
+                  bucketFreedom[bucket] += double(moves.size() - 1) / moves.size();
+               }
+               freedom += moves.size() - 1;
+               samples += drawn;
+            }
+            const auto& move = moves[rng.below(moves.size())];
+            board.applyMove(move.from, move.to, move.promoteTo);
+         }
+      }
+      std::cout << "sampling positions: " << positions << " samples: " << samples << " illegal: " << mismatches << " rejected: " << failures << std::endl;
+      const double z = freedom ? ( chi2 - freedom ) / std::sqrt(2.0 * freedom) : 0.0;
+      std::cout << "chi-square: " << chi2 << " degrees of freedom: " << freedom << " z: " << z << std::endl;
+      failed += mismatches + ( std::fabs(z) > VERIFY_MAX_Z );
+      for ( int bucket = int(ChessFigure::Pawn); bucket <= int(ChessFigure::King); bucket++ ) {
+         const double bz = bucketFreedom[bucket] ? ( bucketChi2[bucket] - bucketFreedom[bucket] ) / std::sqrt(2.0 * bucketFreedom[bucket]) : 0.0;
+         if ( std::fabs(bz) > VERIFY_MAX_Z ) {
+            std::cout << "ERROR: the " << toChar(false, ChessFigure(bucket)) << " moves are not uniform, chi-square: " << bucketChi2[bucket]
+                      << " degrees of freedom: " << bucketFreedom[bucket] << " z: " << bz << std::endl;
+            failed++;
+         }
+      }
+      return failed ? 1 : 0;
+   }
+
+   // BATCH PLAYOUT MODE
+   if ( argc >= 3 && std::string(argv[1]) == "batch" ) {
+      PlayoutJob job;
+      if ( !job.board.initFEN(argv[2]) ) {
+         std::cout << "ERROR: invalid FEN " << argv[2] << std::endl;
+         return 1;
+      }
+      Bitbases bitbases;
+      bitbases.load(BITBASE_FILE);
+      const unsigned count = argc >= 4 ? std::stoi(argv[3]) : 1000;
+      const unsigned long long seed = argc >= 5 ? std::stoull(argv[4]) : 1;
+      std::vector<PlayoutJob> jobs(count, job);
+      for ( unsigned i = 0; i < count; i++ ) {
+         jobs[i].seed = seed + i;
+      }
+      // the scalar engine is the reference
+      Playout playout(&bitbases);
+      std::vector<std::pair<int, unsigned>> expected;
+      auto t1 = std::chrono::steady_clock::now();
+      for ( const auto& elem : jobs ) {
+         Random rng(elem.seed);
+         const int result = playout.run(elem.board, rng);
+         expected.push_back(std::make_pair(result, playout.plies()));
+      }
+      std::chrono::duration<double> scalarSpan = std::chrono::steady_clock::now() - t1;
+      std::unique_ptr<BatchPlayout> batch(new BatchPlayout(&bitbases));
+      t1 = std::chrono::steady_clock::now();
+      batch->run(jobs);
+      std::chrono::duration<double> batchSpan = std::chrono::steady_clock::now() - t1;
+      unsigned mismatches = 0;
+      for ( unsigned i = 0; i < count; i++ ) {
+         mismatches += expected[i] != std::make_pair(jobs[i].result, jobs[i].plies);
+      }
+      std::cout << "scalar playouts/s: " << count / scalarSpan.count() << " batch playouts/s: " << count / batchSpan.count() << std::endl;
+      std::cout << "mismatches: " << mismatches << std::endl;
+      return mismatches ? 1 : 0;
+   }
+
+   // SEARCH MODE
+   if ( argc >= 3 && std::string(argv[1]) == "search" ) {
+      ChessBoard board;
+      if ( !board.initFEN(argv[2]) ) {
+         std::cout << "ERROR: invalid FEN " << argv[2] << std::endl;
+         return 1;
+      }
+      Bitbases bitbases;
+      bitbases.load(BITBASE_FILE);
+      Search search(&bitbases);
+      search.setThreads(argc >= 5 ? std::stoi(argv[4]) : 1);
+      search.setHash(argc >= 6 ? std::stoi(argv[5]) : DEFAULT_HASH_MB);
+      PositionHistory history;
+      history.push(board);
+      const auto best = search.run(board, history, argc >= 4 ? std::stoi(argv[3]) : 1000);
+      ChessMoveVector moves;
+      board.listMoves(moves);
+      for ( const auto& move : moves ) {
+         unsigned visits = 0;
+         const double score = search.score(board, move, visits);
+         std::cout << move << " " << score << " " << visits << std::endl;
+      }
+      std::cout << "best: " << best << " iterations: " << search.iterations() << std::endl;
+      // further arguments are moves in the input file notation, the search continues after each keeping the table
+      for ( int i = 6; i < argc; i++ ) {
+         if ( !board.move(argv[i]) ) {
+            std::cout << "ERROR: cannot apply move " << argv[i] << std::endl;
+            return 1;
+         }
+         history.push(board);
+         const auto reply = search.run(board, history, argc >= 4 ? std::stoi(argv[3]) : 1000);
+         std::cout << argv[i] << " best: " << reply << " iterations: " << search.iterations() << " reused: " << search.reused() << std::endl;
+      }
+      return 0;
+   }
+
+   // UCI MODE
+   if ( argc >= 2 && std::string(argv[1]) == "uci" ) {
+      Bitbases bitbases;
+      bitbases.load(BITBASE_FILE);
+      Uci uci(&bitbases);
+      uci.loop(std::cin, std::cout);
+      return 0;
+   }
+
+   // DAEMON MODE
+   if ( argc >= 3 && std::string(argv[1]) == "serve" ) {
+      // the signals are taken by a thread of their own, the handler could not stop the server safely
+      sigset_t signals;
+      sigemptyset(&signals);
+      sigaddset(&signals, SIGINT);
+      sigaddset(&signals, SIGTERM);
+      pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+      Bitbases bitbases;
+      bitbases.load(BITBASE_FILE);
+      Server server(&bitbases, argc >= 4 ? std::stoi(argv[3]) : DEFAULT_SEARCHERS, argc >= 5 ? std::stoi(argv[4]) : DEFAULT_HASH_MB);
+      if ( !server.listen(argv[2]) ) {
+         std::cout << "ERROR: cannot listen on " << argv[2] << std::endl;
+         return 1;
+      }
+      std::thread waiter([&]() {
+         int signal;
+         sigwait(&signals, &signal);
+         server.stop();
+      });
+      server.run();
+      kill(getpid(), SIGTERM);
+      waiter.join();
+      return 0;
+   }
+
+   // LOAD GENERATOR MODE
+   if ( argc >= 4 && std::string(argv[1]) == "loadgen" ) {
+      const std::string request = argv[3];
+      const unsigned requests = argc >= 5 ? std::stoi(argv[4]) : 1000;
+      const unsigned connections = std::max(1, argc >= 6 ? std::stoi(argv[5]) : 1);
+      std::vector<std::vector<double>> latencies(connections);
+      std::atomic<unsigned> next{0};
+      std::atomic<unsigned> errors{0};
+      auto t1 = std::chrono::steady_clock::now();
+      std::vector<std::thread> clients;
+      for ( unsigned i = 0; i < connections; i++ ) {
+         clients.push_back(std::thread([&, i]() {
+            Connection connection;
+            if ( !connection.connect(argv[2]) ) {
+               errors++;
+               return;
+            }
+            std::string answer;
+            while ( next++ < requests ) {
+               auto start = std::chrono::steady_clock::now();
+               if ( !connection.request(request, answer) ) {
+                  errors++;
+                  return;
+               }
+               std::chrono::duration<double, std::micro> span = std::chrono::steady_clock::now() - start;
+               latencies[i].push_back(span.count());
+               errors += answer.compare(0, 2, "ok") != 0;
+            }
+         }));
+      }
+      for ( auto& elem : clients ) {
+         elem.join();
+      }
+      std::chrono::duration<double> span = std::chrono::steady_clock::now() - t1;
+      std::vector<double> all;
+      for ( const auto& elem : latencies ) {
+         all.insert(all.end(), elem.begin(), elem.end());
+      }
+      std::sort(all.begin(), all.end());
+      auto percentile = [&](double p) { return all.empty() ? 0.0 : all[std::min(all.size() - 1, size_t(p * all.size()))]; };
+      std::cout << "requests: " << all.size() << " errors: " << errors << " requests/s: " << all.size() / span.count() << std::endl;
+      std::cout << "latency us p50: " << percentile(0.5) << " p90: " << percentile(0.9) << " p99: " << percentile(0.99) << " max: " << percentile(1.0) << std::endl;
+      return errors ? 1 : 0;
+   }
+
+   // HOSTING MODE
+   if ( argc >= 3 && std::string(argv[1]) == "host" ) {
+      // the engine plays black in every game, white plays random moves after a random pause,
+      // by default the games keep about two thirds of the workers busy
+      typedef Scheduler::Clock Clock;
+      struct Hosted {
+         ChessBoard board;
+         Clock::time_point deadline;
+         Clock::time_point reply;
+         unsigned moves = 0;
+         bool thinking = false;
+         bool over = false;
+      };
+      const unsigned games = std::stoi(argv[2]);
+      const unsigned milliseconds = argc >= 4 ? std::stoi(argv[3]) : DEFAULT_MOVE_TIME;
+      const unsigned workers = argc >= 5 ? std::stoi(argv[4]) : std::max(1u, std::thread::hardware_concurrency());
+      const unsigned megabytes = argc >= 6 ? std::stoi(argv[5]) : DEFAULT_HASH_MB;
+      const unsigned moves = argc >= 7 ? std::stoi(argv[6]) : 10;
+      const unsigned pause = argc >= 8 ? std::stoi(argv[7]) : 3 * games * milliseconds / std::max(1u, workers);
+      Bitbases bitbases;
+      bitbases.load(BITBASE_FILE);
+      std::vector<Hosted> hosted(games);
+      std::vector<double> lateness;
+      std::mutex mutex;
+      std::condition_variable changed;
+      Random rng(1);
+      auto t1 = Clock::now();
+      Scheduler scheduler(&bitbases, workers, megabytes, DEFAULT_GAME_HASH_MB, [&](unsigned game, const ChessMove& move) {
+         std::lock_guard<std::mutex> lock(mutex);
+         auto& elem = hosted[game];
+         const auto now = Clock::now();
+         std::chrono::duration<double, std::milli> late = now - elem.deadline;
+         lateness.push_back(late.count());
+         elem.thinking = false;
+         elem.moves++;
+         if ( !move.from.valid() || elem.moves >= moves ) {
+            elem.over = true;
+         } else {
+            elem.board.applyMove(move.from, move.to, move.promoteTo);
+            elem.reply = now + std::chrono::milliseconds(rng.below(pause + 1));
+         }
+         changed.notify_one();
+      });
+      std::unique_lock<std::mutex> lock(mutex);
+      for ( unsigned i = 0; i < games; i++ ) {
+         hosted[i].board.initFEN("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+         hosted[i].reply = t1 + std::chrono::milliseconds(rng.below(pause + 1));
+         scheduler.add(hosted[i].board);
+      }
+      for ( ;; ) {
+         const auto now = Clock::now();
+         auto wake = now + std::chrono::seconds(1);
+         bool playing = false;
+         for ( unsigned i = 0; i < games; i++ ) {
+            auto& elem = hosted[i];
+            if ( elem.over ) {
+               continue;
+            }
+            playing = true;
+            if ( elem.thinking ) {
+               continue;
+            }
+            if ( elem.reply > now ) {
+               wake = std::min(wake, elem.reply);
+               continue;
+            }
+            ChessMoveVector replies;
+            elem.board.listMoves(replies);
+            if ( replies.empty() ) {
+               elem.over = true;
+               continue;
+            }
+            const auto& reply = replies[rng.below(replies.size())];
+            elem.board.applyMove(reply.from, reply.to, reply.promoteTo);
+            scheduler.move(i, reply);
+            elem.deadline = Clock::now() + std::chrono::milliseconds(milliseconds);
+            elem.thinking = true;
+            scheduler.think(i, milliseconds);
+         }
+         if ( !playing ) {
+            break;
+         }
+         changed.wait_until(lock, wake);
+      }
+      std::chrono::duration<double> span = Clock::now() - t1;
+      std::sort(lateness.begin(), lateness.end());
+      auto percentile = [&](double p) { return lateness.empty() ? 0.0 : lateness[std::min(lateness.size() - 1, size_t(p * lateness.size()))]; };
+      std::cout << "games: " << games << " moves: " << lateness.size() << " seconds: " << span.count() << " iterations/move: " << scheduler.iterations() / std::max<size_t>(1, lateness.size()) << std::endl;
+      std::cout << "late ms p50: " << percentile(0.5) << " p99: " << percentile(0.99) << " max: " << percentile(1.0) << std::endl;
+      std::cout << "tables peak: " << scheduler.peakTables() << " evictions: " << scheduler.evictions() << std::endl;
+      return 0;
+   }
+
+   // MATCH MODE
+   if ( argc >= 4 && std::string(argv[1]) == "match" ) {
+      PlayerConfig a, b;
+      if ( !a.parse(argv[2]) || !b.parse(argv[3]) ) {
+         std::cout << "ERROR: invalid player, expected key=value,... with ms, playouts, hash, sampling or engine" << std::endl;
+         return 1;
+      }
+      // a child engine dying must not take the match with it
+      signal(SIGPIPE, SIG_IGN);
+      Bitbases bitbases;
+      bitbases.load(BITBASE_FILE);
+      const unsigned games = argc >= 5 ? std::stoi(argv[4]) : 1000;
+      const unsigned threads = argc >= 6 ? std::stoi(argv[5]) : std::max(1u, std::thread::hardware_concurrency());
+      const bool chess960 = argc >= 7 && std::string(argv[6]) == "960";
+      Match match(&bitbases, a, b, threads, chess960, argc >= 8 ? std::stod(argv[7]) : 0, argc >= 9 ? std::stod(argv[8]) : 10);
+      // a rejected version fails, like a failed test
+      return match.run(games, std::cout) < 0 ? 1 : 0;
+   }
+
+   // ANNOTATION MODE
+   if ( argc >= 3 && std::string(argv[1]) == "annotate" ) {
+      std::ifstream ifs(argv[2]);
+      if ( !ifs ) {
+         std::cout << "ERROR: cannot open " << argv[2] << std::endl;
+         return 1;
+      }
+      std::vector<Game> games;
+      readGames(ifs, games);
+      Bitbases bitbases;
+      bitbases.load(BITBASE_FILE);
+      const unsigned threads = argc >= 5 ? std::stoi(argv[4]) : std::max(1u, std::thread::hardware_concurrency());
+      AnalysisCache cache;
+      if ( argc >= 7 && !cache.open(argv[6]) ) {
+         std::cout << "ERROR: cannot open the cache " << argv[6] << std::endl;
+         return 1;
+      }
+      Annotator annotator(&bitbases, argc >= 4 ? std::stoi(argv[3]) : DEFAULT_MOVE_TIME, threads, argc >= 6 ? std::stoi(argv[5]) : DEFAULT_HASH_MB, argc >= 7 ? &cache : nullptr);
+      annotator.run(games, std::cout);
+      return 0;
+   }
+
+   // ANALYSIS CACHE MODE
+   if ( argc >= 3 && std::string(argv[1]) == "cache" ) {
+      AnalysisCache cache;
+      if ( !cache.open(argv[2], argc >= 5 ? std::stoul(argv[4]) : DEFAULT_CACHE_MB) ) {
+         std::cout << "ERROR: cannot open the cache " << argv[2] << std::endl;
+         return 1;
+      }
+      std::cout << "records: " << cache.records() << " positions: " << cache.positions() << std::endl;
+      if ( argc >= 4 && std::string(argv[3]) == "compact" ) {
+         if ( !cache.compact() ) {
+            std::cout << "ERROR: cannot compact the cache " << argv[2] << std::endl;
+            return 1;
+         }
+         std::cout << "compacted records: " << cache.records() << " positions: " << cache.positions() << std::endl;
+      }
+      return 0;
+   }
+
+   // INPUT MODE WITH SHARED PREFIXES
+   if ( argc >= 3 && std::string(argv[1]) == "trie" ) {
+      std::ifstream ifs(argv[2]);
+      if ( !ifs ) {
+         std::cout << "ERROR: cannot read " << argv[2] << std::endl;
+         return 1;
+      }
+      std::vector<Game> games;
+      readGames(ifs, games);
+      VariantTrie trie(games);
+      std::map<std::string, ChessBoard> boards;
+      std::vector<std::string> messages;
+      trie.replay(boards, messages);
+      for ( const auto& elem : messages ) {
+         std::cout << elem << std::endl;
+      }
+      for ( const auto& elem : boards ) {
+         std::cout << "=== " << elem.first << std::endl;
+         std::cout << elem.second << std::endl;
+      }
+      std::cout << "variants: " << games.size() << " moves: " << trie.moves() << " in the trie: " << trie.nodes() << " replayed: " << trie.replayed() << std::endl;
+      return 0;
+   }
+
    // INPUT FILE PROCESSOR MODE
    if ( argc >= 3 && std::string(argv[1]) == "input" ) {
       std::map<std::string, ChessBoard> boards;
@@ -28,6 +668,24 @@ int main(int argc, char* argv[]) {
          std::string toktext;
          bool fen = false;
          std::string fentext;
+         PositionHistory history;
+
+         auto applyToken = [&]() {
+            variant.push_back(toktext);
+            if ( valid && !board.move(toktext) ) {
+               std::cout << "ERROR: " << tagtext << " cannot apply move " << toktext << std::endl;
+               valid = false;
+            }
+            if ( !board.valid() ) {
+               std::cout << "ERROR: " << tagtext << " move " << toktext << " led to failure" << std::endl;
+               valid = false;
+            }
+            history.push(board);
+            if ( valid && history.repetitions(board.clocks_[HALF_CLOCK]) == 2 ) {
+               std::cout << "NOTE: " << tagtext << " threefold repetition after " << toktext << std::endl;
+            }
+            tok = false;
+         };
 
          while ( getline(ifs, line) ) {
             if ( num ) {
@@ -38,16 +696,7 @@ int main(int argc, char* argv[]) {
                num = false;
             }
             if ( tok ) {
-               variant.push_back(toktext);
-               if ( valid && !board.move(toktext) ) {
-                  std::cout << "ERROR: " << tagtext << " cannot apply move " << toktext << std::endl;
-                  valid = false;
-               }
-               if ( !board.valid() ) {
-                  std::cout << "ERROR: " << tagtext << " move " << toktext << " led to failure" << std::endl;
-                  valid = false;
-               }
-               tok = false;
+               applyToken();
             }
             auto tpos = line.find('#');
             if ( tpos != std::string::npos ) {
@@ -58,6 +707,8 @@ int main(int argc, char* argv[]) {
                   if ( elem == '}' ) {
                      fen = false;
                      board.initFEN(fentext);
+                     history.clear();
+                     history.push(board);
                   } else {
                      fentext += elem;
                   }
@@ -79,16 +730,7 @@ int main(int argc, char* argv[]) {
                   }
                } else if (tok) {
                   if ( isspace(elem) ) {
-                     variant.push_back(toktext);
-                     if ( valid && !board.move(toktext) ) {
-                        std::cout << "ERROR: " << tagtext << " cannot apply move " << toktext << std::endl;
-                        valid = false;
-                     }
-                     if ( !board.valid() ) {
-                        std::cout << "ERROR: " << tagtext << " move " << toktext << " led to failure" << std::endl;
-                        valid = false;
-                     }
-                     tok = false;
+                     applyToken();
                   } else {
                      toktext += elem;
                   }
@@ -104,6 +746,8 @@ int main(int argc, char* argv[]) {
                      tagtext = "";
                      board.init();
                      variant.clear();
+                     history.clear();
+                     history.push(board);
                   } else if ( elem == '{' ) {
                      fen = true;
                      fentext = "";
@@ -0,0 +1,398 @@
+#include "match.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "uci.hpp"
+
+// a plain decimal number that fits into max
+static bool
+parseNumber(const std::string& text, unsigned long max, unsigned long& value) {
+   if ( text.empty() || !isdigit(text[0]) ) {
+      return false;
+   }
+   char* end = nullptr;
+   errno = 0;
+   value = strtoul(text.c_str(), &end, 10);
+   return !*end && !errno && value <= max;
+}
+
+bool
+PlayerConfig::parse(const std::string& text) {
+   name = text;
+   std::stringstream ss(text);
+   std::string item;
+   while ( getline(ss, item, ',') ) {
+      const auto eq = item.find('=');
+      if ( eq == std::string::npos ) {
+         return false;
+      }
+      const std::string key = item.substr(0, eq);
+      const std::string value = item.substr(eq + 1);
+      unsigned long number = 0;
+      if ( key == "ms" ) {
+         if ( !parseNumber(value, std::numeric_limits<unsigned>::max(), number) ) {
+            return false;
+         }
+         milliseconds = number;
+      } else if ( key == "playouts" ) {
+         if ( !parseNumber(value, std::numeric_limits<unsigned long>::max(), playouts) ) {
+            return false;
+         }
+      } else if ( key == "hash" ) {
+         if ( !parseNumber(value, std::numeric_limits<unsigned>::max(), number) ) {
+            return false;
+         }
+         hash = number;
+      } else if ( key == "sampling" ) {
+         if ( value != "0" && value != "1" ) {
+            return false;
+         }
+         sampling = value == "1";
+      } else if ( key == "engine" ) {
+         std::stringstream words(value);
+         engine.clear();
+         while ( words >> item ) {
+            engine.push_back(item);
+         }
+      } else {
+         return false;
+      }
+   }
+   return true;
+}
+
+MatchPlayer::MatchPlayer(const Bitbases* bitbases, const PlayerConfig& config) : config_(config), search_(bitbases, config.hash) {
+   search_.setSampling(config.sampling);
+   if ( config.engine.empty() ) {
+      ready_ = true;
+      return;
+   }
+   int toChild[2];
+   int fromChild[2];
+   if ( pipe(toChild) || pipe(fromChild) ) {
+      return;
+   }
+   pid_ = fork();
+   if ( pid_ == 0 ) {
+      dup2(toChild[0], STDIN_FILENO);
+      dup2(fromChild[1], STDOUT_FILENO);
+      close(toChild[0]);
+      close(toChild[1]);
+      close(fromChild[0]);
+      close(fromChild[1]);
+      std::vector<char*> args;
+      for ( const auto& elem : config.engine ) {
+         args.push_back(const_cast<char*>(elem.c_str()));
+      }
+      args.push_back(nullptr);
+      execvp(args[0], args.data());
+      _exit(127);
+   }
+   close(toChild[0]);
+   close(fromChild[1]);
+   if ( pid_ < 0 ) {
+      close(toChild[1]);
+      close(fromChild[0]);
+      return;
+   }
+   in_ = fdopen(toChild[1], "w");
+   out_ = fdopen(fromChild[0], "r");
+   std::string line;
+   if ( !send("uci") || !expect("uciok", line) ) {
+      return;
+   }
+   send("setoption name Hash value " + std::to_string(config.hash));
+   send("setoption name Threads value 1");
+   send("setoption name UCI_Chess960 value true");
+   if ( config.sampling ) {
+      send("setoption name Sampling value true");
+   }
+   ready_ = send("isready") && expect("readyok", line);
+}
+
+MatchPlayer::~MatchPlayer() {
+   if ( pid_ <= 0 ) {
+      return;
+   }
+   send("quit");
+   if ( in_ ) {
+      fclose(in_);
+   }
+   if ( out_ ) {
+      fclose(out_);
+   }
+   waitpid(pid_, nullptr, 0);
+}
+
+bool
+MatchPlayer::send(const std::string& line) {
+   return in_ && fputs((line + "\n").c_str(), in_) >= 0 && fflush(in_) == 0;
+}
+
+// skips the lines up to the one starting with the token, counting the nodes of the info lines on the way
+bool
+MatchPlayer::expect(const std::string& token, std::string& line) {
+   char buffer[4096];
+   while ( out_ && fgets(buffer, sizeof(buffer), out_) ) {
+      line = buffer;
+      std::istringstream iss(line);
+      std::string word;
+      iss >> word;
+      if ( word == token ) {
+         return true;
+      }
+      while ( word == "info" && iss >> word ) {
+         if ( word == "nodes" ) {
+            unsigned long nodes = 0;
+            iss >> nodes;
+            iterations_ += nodes;
+            break;
+         }
+      }
+   }
+   return false;
+}
+
+bool
+MatchPlayer::newGame() {
+   if ( config_.engine.empty() ) {
+      search_.clear();
+      return true;
+   }
+   std::string line;
+   return send("ucinewgame") && send("isready") && expect("readyok", line);
+}
+
+bool
+MatchPlayer::play(const std::string& fen, const std::string& moves, const ChessBoard& board, const PositionHistory& history, ChessMove& move) {
+   if ( config_.engine.empty() ) {
+      search_.start(config_.playouts ? 0 : config_.milliseconds, config_.playouts);
+      move = search_.run(board, history);
+      iterations_ += search_.iterations();
+      return true;
+   }
+   const std::string limit = config_.playouts ? "nodes " + std::to_string(config_.playouts) : "movetime " + std::to_string(config_.milliseconds);
+   std::string line;
+   if ( !send("position fen " + fen + ( moves.empty() ? "" : " moves " + moves )) || !send("go " + limit) || !expect("bestmove", line) ) {
+      return false;
+   }
+   std::istringstream iss(line);
+   std::string token;
+   iss >> token >> token;
+   return Uci::parseMove(board, token, move);
+}
+
+std::string
+Match::start(unsigned long long seed, bool chess960, std::string& moves) {
+   Random rng(seed);
+   moves.clear();
+   if ( chess960 ) {
+      // bishops on both colors, then queen and knights anywhere, the king goes between the rooks
+      std::string rank(NUMBER_OF_COLS, ' ');
+      rank[2 * rng.below(4) + 1] = 'b';
+      rank[2 * rng.below(4)] = 'b';
+      for ( const char fig : std::string("qnn") ) {
+         unsigned free = rng.below(std::count(rank.begin(), rank.end(), ' '));
+         for ( auto& elem : rank ) {
+            if ( elem == ' ' && !free-- ) {
+               elem = fig;
+               break;
+            }
+         }
+      }
+      std::string casts;
+      for ( const char fig : std::string("rkr") ) {
+         const auto col = rank.find(' ');
+         rank[col] = fig;
+         if ( fig == 'r' ) {
+            casts += char('A' + col);
+         }
+      }
+      std::string upper = rank;
+      std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+      std::string lower = casts;
+      std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+      return rank + "/pppppppp/8/8/8/8/PPPPPPPP/" + upper + " w " + casts + lower + " - 0 1";
+   }
+   const std::string fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+   ChessBoard board;
+   board.initFEN(fen);
+   ChessMoveVector legal;
+   for ( unsigned i = 0; i < RANDOM_START_PLIES; i++ ) {
+      board.listMoves(legal);
+      if ( legal.empty() ) {
+         break;
+      }
+      const auto& move = legal[rng.below(legal.size())];
+      moves += ( moves.empty() ? "" : " " ) + Uci::formatMove(board, move, true);
+      board.applyMove(move.from, move.to, move.promoteTo);
+   }
+   return fen;
+}
+
+int
+Match::game(const std::string& fen, std::string moves, MatchPlayer& white, MatchPlayer& black, bool& error, unsigned& plies) const {
+   ChessBoard board;
+   board.initFEN(fen);
+   PositionHistory history;
+   history.push(board);
+   std::istringstream iss(moves);
+   std::string token;
+   while ( iss >> token ) {
+      ChessMove move;
+      Uci::parseMove(board, token, move);
+      board.applyMove(move.from, move.to, move.promoteTo);
+      history.push(board);
+   }
+   error = !white.newGame() || !black.newGame();
+   ChessMoveVector legal;
+   for ( plies = 0; !error && plies < MATCH_MAX_PLIES; plies++ ) {
+      int result;
+      if ( bitbases_ && bitbases_->probe(board, result) ) {
+         return board.color_ ? result : -result;
+      }
+      board.listMoves(legal);
+      if ( legal.empty() ) {
+         return board.check(board.color_) ? ( board.color_ ? -1 : +1 ) : 0;
+      }
+      if ( board.clocks_[HALF_CLOCK] >= FIFTY_MOVES_CLOCK || history.repetitions(board.clocks_[HALF_CLOCK]) >= 2 ) {
+         return 0;
+      }
+      // a player failing to answer with a legal move loses the game
+      ChessMove move;
+      auto& player = board.color_ ? white : black;
+      if ( !player.play(fen, moves, board, history, move) || std::find(legal.begin(), legal.end(), move) == legal.end() ) {
+         error = true;
+         return board.color_ ? -1 : +1;
+      }
+      moves += ( moves.empty() ? "" : " " ) + Uci::formatMove(board, move, true);
+      board.applyMove(move.from, move.to, move.promoteTo);
+      history.push(board);
+   }
+   return 0;
+}
+
+// generalized SPRT on the pairs with the logistic Elo model, see Michel Van den Bergh's notes on normalized Elo
+int
+Match::sprt(const Stats& stats, double& llr, double& elo, double& margin) const {
+   unsigned n = 0;
+   double mean = 0;
+   for ( unsigned i = 0; i < stats.pairs.size(); i++ ) {
+      n += stats.pairs[i];
+      mean += stats.pairs[i] * i / 4.0;
+   }
+   llr = elo = margin = 0;
+   if ( !n ) {
+      return 0;
+   }
+   mean /= n;
+   double variance = 0;
+   for ( unsigned i = 0; i < stats.pairs.size(); i++ ) {
+      variance += stats.pairs[i] * ( i / 4.0 - mean ) * ( i / 4.0 - mean );
+   }
+   variance /= n;
+   auto toElo = [](double score) {
+      score = std::min(std::max(score, 1e-6), 1 - 1e-6);
+      return -400 * std::log10(1 / score - 1);
+   };
+   auto toScore = [](double elo) { return 1 / ( 1 + std::pow(10, -elo / 400) ); };
+   elo = toElo(mean);
+   const double deviation = 1.96 * std::sqrt(variance / n);
+   margin = ( toElo(mean + deviation) - toElo(mean - deviation) ) / 2;
+   if ( variance <= 0 || n < SPRT_MIN_PAIRS ) {
+      return 0;
+   }
+   const double s0 = toScore(elo0_);
+   const double s1 = toScore(elo1_);
+   llr = n * ( s1 - s0 ) * ( 2 * mean - s0 - s1 ) / ( 2 * variance );
+   return llr >= std::log(( 1 - SPRT_BETA ) / SPRT_ALPHA) ? +1 : llr <= std::log(SPRT_BETA / ( 1 - SPRT_ALPHA )) ? -1 : 0;
+}
+
+void
+Match::report(const Stats& stats, double seconds, std::ostream& os) const {
+   double llr, elo, margin;
+   sprt(stats, llr, elo, margin);
+   const unsigned games = stats.wins + stats.draws + stats.losses;
+   os << "games: " << games << " +" << stats.wins << " =" << stats.draws << " -" << stats.losses << " errors: " << stats.errors
+      << " elo: " << elo << " +- " << margin << " llr: " << llr << " [" << std::log(SPRT_BETA / ( 1 - SPRT_ALPHA )) << ", " << std::log(( 1 - SPRT_BETA ) / SPRT_ALPHA) << "]"
+      << " games/s: " << games / seconds << " moves/s: " << stats.plies / seconds
+      << " iterations/move A: " << stats.iterationsA / std::max(1ul, stats.movesA) << " B: " << stats.iterationsB / std::max(1ul, stats.movesB) << std::endl;
+}
+
+int
+Match::run(unsigned games, std::ostream& os) {
+   Stats stats;
+   int decision = 0;
+   std::atomic<unsigned> next{0};
+   std::atomic<bool> stop{false};
+   std::mutex mutex;
+   const auto t1 = std::chrono::steady_clock::now();
+   auto elapsed = [&]() { return std::chrono::duration<double>(std::chrono::steady_clock::now() - t1).count(); };
+   auto work = [&]() {
+      MatchPlayer a(bitbases_, a_);
+      MatchPlayer b(bitbases_, b_);
+      if ( !a.ready() || !b.ready() ) {
+         std::lock_guard<std::mutex> lock(mutex);
+         os << "ERROR: cannot start the engine of " << ( a.ready() ? b_.name : a_.name ) << std::endl;
+         stop = true;
+         return;
+      }
+      for ( unsigned pair = next++; !stop && 2 * pair < games; pair = next++ ) {
+         std::string moves;
+         const std::string fen = start(pair + 1, chess960_, moves);
+         const unsigned long iterationsA = a.iterations();
+         const unsigned long iterationsB = b.iterations();
+         bool errorA, errorB;
+         unsigned pliesA, pliesB;
+         const int first = game(fen, moves, a, b, errorA, pliesA);
+         const int second = -game(fen, moves, b, a, errorB, pliesB);
+         std::lock_guard<std::mutex> lock(mutex);
+         stats.pairs[2 + first + second]++;
+         for ( const int result : {first, second} ) {
+            stats.wins += result > 0;
+            stats.draws += result == 0;
+            stats.losses += result < 0;
+         }
+         stats.errors += errorA + errorB;
+         stats.plies += pliesA + pliesB;
+         // white moves first, so A made the odd ply of the first game and the even one of the second
+         stats.iterationsA += a.iterations() - iterationsA;
+         stats.iterationsB += b.iterations() - iterationsB;
+         stats.movesA += ( pliesA + 1 ) / 2 + pliesB / 2;
+         stats.movesB += pliesA / 2 + ( pliesB + 1 ) / 2;
+         if ( !decision ) {
+            double llr, elo, margin;
+            decision = sprt(stats, llr, elo, margin);
+            stop = decision != 0;
+         }
+         // the last pair and the one that decides leave their report to the final one
+         const unsigned played = stats.wins + stats.draws + stats.losses;
+         if ( played % ( 2 * MATCH_REPORT_PAIRS ) == 0 && played < games && !stop ) {
+            report(stats, elapsed(), os);
+         }
+      }
+   };
+   std::vector<std::thread> helpers;
+   for ( unsigned i = 1; i < threads_; i++ ) {
+      helpers.push_back(std::thread(work));
+   }
+   work();
+   for ( auto& elem : helpers ) {
+      elem.join();
+   }
+   report(stats, elapsed(), os);
+   os << "sprt elo0: " << elo0_ << " elo1: " << elo1_ << " " << ( decision > 0 ? "H1 accepted" : decision < 0 ? "H0 accepted" : "inconclusive" ) << std::endl;
+   return decision;
+}
@@ -0,0 +1,103 @@
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <array>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "bitbase.hpp"
+#include "search.hpp"
+
+constexpr unsigned MATCH_MAX_PLIES = 400; // adjudicated as a draw
+constexpr unsigned RANDOM_START_PLIES = 8;
+constexpr unsigned MATCH_REPORT_PAIRS = 10;
+constexpr unsigned MATCH_HASH_MB = 4;
+constexpr double SPRT_ALPHA = 0.05;
+constexpr double SPRT_BETA = 0.05;
+constexpr unsigned SPRT_MIN_PAIRS = 16; // the variance of fewer pairs is no estimate
+
+// One side of a match as "key=value,..." with the keys
+//    ms: time per move, playouts: iterations per move instead of time, hash: MB, sampling: 0 or 1,
+//    engine: command line of another build speaking UCI, the other keys are then sent to it as go limits and options.
+struct PlayerConfig {
+   bool parse(const std::string& text);
+
+   std::string name;
+   unsigned milliseconds = DEFAULT_MOVE_TIME;
+   unsigned long playouts = 0;
+   unsigned hash = MATCH_HASH_MB;
+   bool sampling = false;
+   std::vector<std::string> engine;
+};
+
+// A side of a game, either the search of this process in the calling thread or a child process.
+class MatchPlayer {
+public:
+   MatchPlayer(const Bitbases* bitbases, const PlayerConfig& config);
+   MatchPlayer(const MatchPlayer&) = delete;
+   MatchPlayer& operator=(const MatchPlayer&) = delete;
+   ~MatchPlayer();
+
+   // false if the engine could not be started
+   bool ready() const { return ready_; }
+   bool newGame();
+   // fen and moves are the whole game for the engine, board and history are its current position
+   bool play(const std::string& fen, const std::string& moves, const ChessBoard& board, const PositionHistory& history, ChessMove& move);
+   unsigned long iterations() const { return iterations_; }
+
+private:
+   bool send(const std::string& line);
+   bool expect(const std::string& token, std::string& line);
+
+   const PlayerConfig& config_;
+   Search search_;
+   unsigned long iterations_ = 0;
+   bool ready_ = false;
+   int pid_ = -1;
+   FILE* in_ = nullptr;
+   FILE* out_ = nullptr;
+};
+
+// Plays A against B in pairs of games from the same start, each side having white once.
+// The pairs feed a sequential probability ratio test of elo0 against elo1, the match stops once it decides.
+class Match {
+public:
+   Match(const Bitbases* bitbases, const PlayerConfig& a, const PlayerConfig& b, unsigned threads, bool chess960, double elo0, double elo1)
+      : bitbases_(bitbases), a_(a), b_(b), threads_(std::max(1u, threads)), chess960_(chess960), elo0_(elo0), elo1_(elo1) {}
+
+   // returns +1 if elo1 was accepted, -1 for elo0, 0 if the games ran out first
+   int run(unsigned games, std::ostream& os);
+
+   // start of the pair, a Chess960 back rank or a few random plies from the standard start
+   static std::string start(unsigned long long seed, bool chess960, std::string& moves);
+
+private:
+   struct Stats {
+      std::array<unsigned, 5> pairs {}; // by the points of A in the pair, in half points
+      unsigned wins = 0;
+      unsigned draws = 0;
+      unsigned losses = 0;
+      unsigned errors = 0;
+      unsigned long plies = 0;
+      unsigned long iterationsA = 0;
+      unsigned long iterationsB = 0;
+      unsigned long movesA = 0;
+      unsigned long movesB = 0;
+   };
+   // +1 white wins, -1 black wins, 0 draw, also for the faults of a player
+   int game(const std::string& fen, std::string moves, MatchPlayer& white, MatchPlayer& black, bool& error, unsigned& plies) const;
+   int sprt(const Stats& stats, double& llr, double& elo, double& margin) const;
+   void report(const Stats& stats, double seconds, std::ostream& os) const;
+
+   const Bitbases* bitbases_;
+   const PlayerConfig& a_;
+   const PlayerConfig& b_;
+   unsigned threads_;
+   bool chess960_;
+   double elo0_;
+   double elo1_;
+};
+
+#endif /* MATCH_H */
@@ -0,0 +1,180 @@
+#include "notation.hpp"
+
+#include <cctype>
+#include <cstdlib>
+
+static void
+readInputGames(std::istream& is, std::vector<Game>& games) {
+   std::string line;
+   std::string text; // tag or FEN in progress
+   char closing = 0;
+   std::string token;
+   unsigned number = 0;
+   while ( getline(is, line) ) {
+      line = line.substr(0, line.find('#'));
+      line += ' ';
+      for ( const auto& elem : line ) {
+         if ( closing ) {
+            if ( elem != closing ) {
+               text += elem;
+            } else if ( closing == ')' ) {
+               games.back().tag = text;
+               closing = 0;
+            } else {
+               if ( !games.empty() ) {
+                  games.back().fen = text;
+               }
+               closing = 0;
+            }
+         } else if ( isspace(elem) || elem == '.' ) {
+            if ( !token.empty() && isdigit(token[0]) ) {
+               number = strtoul(token.c_str(), nullptr, 10);
+            } else if ( !token.empty() && !games.empty() ) {
+               games.back().moves.push_back(token);
+               games.back().numbers.push_back(number);
+               number = 0;
+            }
+            token.clear();
+         } else if ( elem == '(' || elem == '{' ) {
+            if ( elem == '(' ) {
+               games.push_back(Game());
+               number = 0;
+            }
+            closing = elem == '(' ? ')' : '}';
+            text.clear();
+         } else {
+            token += elem;
+         }
+      }
+   }
+}
+
+static void
+readPGNGames(std::istream& is, std::vector<Game>& games) {
+   std::string line;
+   bool inGame = false;
+   unsigned depth = 0; // of the skipped variations
+   bool comment = false;
+   std::string token;
+   auto flush = [&]() {
+      if ( token == "1-0" || token == "0-1" || token == "1/2-1/2" || token == "*" ) {
+         inGame = false;
+      } else if ( depth || token.empty() || token[0] == '$' || games.empty() ) {
+      } else if ( !isdigit(token[0]) ) {
+         games.back().moves.push_back(token);
+         games.back().numbers.push_back(0);
+      } else if ( token.size() > 1 && token[0] == '0' ) { // 0-0 castling
+         for ( auto& chr : token ) {
+            chr = chr == '0' ? 'O' : chr;
+         }
+         games.back().moves.push_back(token);
+         games.back().numbers.push_back(0);
+      }
+      token.clear();
+   };
+   while ( getline(is, line) ) {
+      if ( !comment && !depth && !line.empty() && line[0] == '[' ) {
+         if ( !inGame ) {
+            games.push_back(Game());
+            inGame = true;
+         }
+         auto qpos = line.find('"');
+         auto epos = line.rfind('"');
+         if ( qpos != std::string::npos && epos > qpos ) {
+            const std::string name = line.substr(1, line.find(' ') - 1);
+            const std::string value = line.substr(qpos + 1, epos - qpos - 1);
+            games.back().headers.push_back(std::make_pair(name, value));
+            if ( name == "FEN" ) {
+               games.back().fen = value;
+            } else if ( name == "White" || name == "Black" ) {
+               games.back().tag += ( games.back().tag.empty() ? "" : " - " ) + value;
+            }
+         }
+         continue;
+      }
+      for ( const auto& elem : line ) {
+         if ( comment ) {
+            comment = elem != '}';
+         } else if ( elem == ';' ) {
+            break;
+         } else if ( isspace(elem) || elem == '.' || elem == '{' || elem == '(' || elem == ')' ) {
+            flush();
+            comment = elem == '{';
+            if ( elem == '(' ) {
+               depth++;
+            } else if ( elem == ')' && depth ) {
+               depth--;
+            }
+         } else {
+            token += elem;
+         }
+      }
+      flush();
+   }
+}
+
+void
+readGames(std::istream& is, std::vector<Game>& games) {
+   while ( isspace(is.peek()) ) {
+      is.get();
+   }
+   if ( is.peek() == '[' ) {
+      readPGNGames(is, games);
+   } else {
+      readInputGames(is, games);
+   }
+}
+
+std::string
+toSAN(const ChessBoard& board, const ChessMove& move) {
+   const auto sq = board.getSquare(move.from);
+   const auto tsq = board.getSquare(move.to);
+   std::string retval;
+   if ( sq.figure() == ChessFigure::King && tsq == ChessSquare(ChessFigure::Rook, sq.color()) ) {
+      retval = move.to.col < move.from.col ? "O-O-O" : "O-O";
+   } else {
+      const bool capture = !tsq.empty() || ( sq.figure() == ChessFigure::Pawn && move.from.col != move.to.col );
+      if ( sq.figure() == ChessFigure::Pawn ) {
+         if ( capture ) {
+            retval += move.from.pcol();
+         }
+      } else {
+         retval += toChar(true, sq.figure());
+         ChessMoveVector moves;
+         board.listMoves(moves);
+         bool ambiguous = false;
+         bool sameCol = false;
+         bool sameRow = false;
+         for ( const auto& elem : moves ) {
+            if ( elem.to == move.to && !( elem.from == move.from ) && board.getSquare(elem.from) == sq ) {
+               ambiguous = true;
+               sameCol = sameCol || elem.from.col == move.from.col;
+               sameRow = sameRow || elem.from.row == move.from.row;
+            }
+         }
+         if ( ambiguous && ( !sameCol || sameRow ) ) {
+            retval += move.from.pcol();
+         }
+         if ( ambiguous && sameCol ) {
+            retval += move.from.prow();
+         }
+      }
+      if ( capture ) {
+         retval += 'x';
+      }
+      retval += move.to.pcol();
+      retval += move.to.prow();
+      if ( move.promoteTo != ChessFigure::None ) {
+         retval += '=';
+         retval += toChar(true, move.promoteTo);
+      }
+   }
+   ChessBoard next = board;
+   next.applyMove(move.from, move.to, move.promoteTo);
+   if ( next.check(next.color_) ) {
+      ChessMoveVector replies;
+      next.listMoves(replies);
+      retval += replies.empty() ? '#' : '+';
+   }
+   return retval;
+}
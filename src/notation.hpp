@@ -0,0 +1,28 @@
+#ifndef NOTATION_H
+#define NOTATION_H
+
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "primitives.hpp"
+
+// A game or variant as written in an input file or in PGN, the moves are not checked here.
+struct Game {
+   std::string tag;
+   std::vector<std::pair<std::string, std::string>> headers;
+   std::string fen; // empty for the standard start
+   std::vector<std::string> moves;
+   std::vector<unsigned> numbers; // move number written right before each move in the input format, 0 if none
+
+   bool start(ChessBoard& board) const { return fen.empty() ? ( board.init(), true ) : board.initFEN(fen); }
+};
+
+// Reads the "(TAG) 1. e4 e5 {FEN} ..." input file format, or PGN if the first thing in the stream is a header.
+void readGames(std::istream& is, std::vector<Game>& games);
+
+// Standard algebraic notation of a legal move.
+std::string toSAN(const ChessBoard& board, const ChessMove& move);
+
+#endif /* NOTATION_H */
@@ -0,0 +1,90 @@
+/* omice.h: batched C interface of the omice move generator, "make lib" builds libomice.so and libomice.a.
+ *
+ * Every call works on arrays of n items and writes only into buffers owned by the caller, nothing is kept between calls,
+ * so the calls are safe from any number of threads. The calls do not allocate: FENs are parsed in place and the moves are
+ * listed into a fixed array on the stack, a board with more legal moves than it holds counts as invalid.
+ * Squares are coded as row * 8 + column, a1 = 0, h1 = 7, a8 = 56.
+ * Moves are UCI text like "e2e4", "e7e8q", castling is either the king's two-square move or the king taking its own rook.
+ */
+#ifndef OMICE_H
+#define OMICE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+   OMICE_ABI_VERSION = 2
+};
+
+/* promotion pieces of omice_move */
+enum {
+   OMICE_NONE = 0,
+   OMICE_KNIGHT = 2,
+   OMICE_BISHOP = 3,
+   OMICE_ROOK = 4,
+   OMICE_QUEEN = 5
+};
+
+/* results of omice_validate */
+enum {
+   OMICE_ILLEGAL = 0,
+   OMICE_LEGAL = 1,
+   OMICE_BAD_FEN = -1,
+   OMICE_BAD_MOVE = -2
+};
+
+/* format of omice_board, in its last byte */
+enum {
+   OMICE_BOARD_FORMAT = 1
+};
+
+/* a position in a fixed layout, the boards given to the calls are checked, invalid ones have no moves:
+ *    data[0] .. data[31]   the squares, square s in the low nibble of data[s / 2] when s is even, else in the high nibble,
+ *                          a nibble is piece * 2 + 1 for white, piece * 2 for black, 0 for empty,
+ *                          the pieces are 1 pawn, 2 knight, 3 bishop, 4 rook, 5 queen, 6 king
+ *    data[32]              side to move, 1 white, 0 black
+ *    data[33] .. data[36]  column of the castling rook or 255: white long, white short, black long, black short
+ *    data[37]              column of the en passant capture or 255, only set when such a capture is legal
+ *    data[38], data[39]    half move clock, full move number
+ *    data[40] .. data[62]  zero
+ *    data[63]              OMICE_BOARD_FORMAT, 0 for the boards omice_load could not parse */
+typedef struct omice_board {
+   unsigned char data[64];
+} omice_board;
+
+typedef struct omice_move {
+   unsigned char from;
+   unsigned char to;
+   unsigned char promotion;
+   unsigned char reserved;
+} omice_move;
+
+/* OMICE_ABI_VERSION of the library */
+int omice_abi_version(void);
+
+/* parses the FENs into boards, ok[i] tells whether fens[i] was valid, returns the number of valid ones */
+size_t omice_load(const char* const* fens, size_t n, omice_board* boards, unsigned char* ok);
+
+/* checks the move moves[i] in the position fens[i], results[i] is one of OMICE_LEGAL, OMICE_ILLEGAL, OMICE_BAD_FEN, OMICE_BAD_MOVE,
+ * returns the number of legal moves */
+size_t omice_validate(const char* const* fens, const char* const* moves, size_t n, signed char* results);
+
+/* the legal moves of the boards one after the other, those of boards[i] are out[offsets[i]] .. out[offsets[i + 1] - 1],
+ * so offsets has n + 1 items, returns the number of moves or (size_t)-1 if capacity was too small */
+size_t omice_list_moves(const omice_board* boards, size_t n, omice_move* out, size_t capacity, size_t* offsets);
+
+/* the squares of the pieces that have a legal move, laid out like omice_list_moves */
+size_t omice_list_mobile(const omice_board* boards, size_t n, unsigned char* out, size_t capacity, size_t* offsets);
+
+/* plays moves[i] on boards[i] when it is legal, ok[i] tells which ones were, the other boards stay unchanged,
+ * returns the number of moves played */
+size_t omice_apply(omice_board* boards, const omice_move* moves, size_t n, unsigned char* ok);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OMICE_H */
@@ -0,0 +1,137 @@
+#include "playout.hpp"
+
+TargetTables::TargetTables() {
+   for ( unsigned sq = 0; sq < NUMBER_OF_SQUARES; sq++ ) {
+      const Pos from = PosFromCode(sq);
+      auto add = [&](Targets& targets, const Pos& to) {
+         if ( to.valid() ) {
+            targets.squares[targets.size++] = to.code();
+         }
+      };
+      for ( auto color : COLORS ) {
+         const int dir = color ? +1 : -1;
+         if ( from.row == FIRST_ROW || from.row == LAST_ROW ) {
+            continue;
+         }
+         add(pawns[color][sq], from.add(Pos(dir, 0)));
+         if ( from.row == ( color ? FIRST_PAWN_ROW : LAST_PAWN_ROW ) ) {
+            add(pawns[color][sq], from.add(Pos(2 * dir, 0)));
+         }
+         add(pawns[color][sq], from.add(Pos(dir, -1)));
+         add(pawns[color][sq], from.add(Pos(dir, +1)));
+      }
+      Pos kpos = from.add(KNIGHT_FIRST_DIR);
+      Pos kshift = KNIGHT_FIRST_SHIFT;
+      for ( size_t i = 0; i < 8; i ++ ) {
+         add(pieces[int(ChessFigure::Knight)][sq], kpos);
+         kpos.move(kshift);
+         kshift.knightShiftRot();
+      }
+      Pos dir;
+      for ( dir.row = -1; dir.row <= +1; dir.row++ ) {
+         for ( dir.col = -1; dir.col <= +1; dir.col++ ) {
+            if ( dir.null() ) {
+               continue;
+            }
+            add(pieces[int(ChessFigure::King)][sq], from.add(dir));
+            for ( Pos to = from.add(dir); to.valid(); to.move(dir) ) {
+               add(pieces[int(dir.minorType())][sq], to);
+               add(pieces[int(ChessFigure::Queen)][sq], to);
+            }
+         }
+      }
+   }
+}
+
+bool
+Playout::sample(const ChessBoard& board, Random& rng, ChessMove& move) {
+   // every piece gets as many slots as it has candidate moves, so each legal move owns exactly one slot
+   const bool color = board.color_;
+   unsigned size = 0;
+   unsigned total = 0;
+   Pos pos;
+   for ( pos.row = 0; pos.row < NUMBER_OF_ROWS; pos.row++ ) {
+      for ( pos.col = 0; pos.col < NUMBER_OF_COLS; pos.col++ ) {
+         const auto psq = board.getSquareUnsafe(pos);
+         if ( psq.empty() || psq.color() != color ) {
+            continue;
+         }
+         const auto fig = psq.figure();
+         const auto& targets = fig == ChessFigure::Pawn ? TARGETS.pawns[color][pos.code()] : TARGETS.pieces[int(fig)][pos.code()];
+         if ( fig == ChessFigure::Pawn && pos.row == ( color ? LAST_PAWN_ROW : FIRST_PAWN_ROW ) ) {
+            total += targets.size * PROMOTIONS.size();
+         } else {
+            total += targets.size + ( fig == ChessFigure::King ? CASTS_SIDES : 0 );
+         }
+         pieces_[size] = pos.code();
+         bounds_[size++] = total;
+      }
+   }
+   const unsigned char check = board.check(color);
+   for ( unsigned attempt = 0; attempt < SAMPLE_ATTEMPTS; attempt++ ) {
+      unsigned slot = rng.below(total);
+      unsigned i = 0;
+      while ( slot >= bounds_[i] ) {
+         i++;
+      }
+      slot -= i ? bounds_[i - 1] : 0;
+      const Pos from = PosFromCode(pieces_[i]);
+      const auto fig = board.getSquareUnsafe(from).figure();
+      const auto& targets = fig == ChessFigure::Pawn ? TARGETS.pawns[color][from.code()] : TARGETS.pieces[int(fig)][from.code()];
+      Pos to;
+      ChessFigure promoteTo = ChessFigure::None;
+      if ( fig == ChessFigure::King && slot >= targets.size ) {
+         // castling is the king taking its own rook
+         to = board.getCastPos(color, slot - targets.size);
+         if ( check || !to.valid() ) {
+            continue;
+         }
+      } else {
+         to = PosFromCode(targets.squares[slot % targets.size]);
+         const auto tsq = board.getSquareUnsafe(to);
+         if ( !tsq.empty() && tsq.color() == color ) {
+            continue;
+         }
+         if ( board.isPromotion(from, to, fig) ) {
+            promoteTo = PROMOTIONS[slot / targets.size];
+         }
+      }
+      if ( board.isMoveValid(from, to, fig != ChessFigure::King && board.isPinned(from), check) ) {
+         move = ChessMove(from, to, promoteTo);
+         return true;
+      }
+   }
+   return false;
+}
+
+int
+Playout::run(ChessBoard board, Random& rng, const PositionHistory* history) {
+   if ( history ) {
+      history_ = *history;
+   } else {
+      history_.clear();
+      history_.push(board);
+   }
+   for ( plies_ = 0; ; plies_++ ) {
+      int result;
+      // the material only changes when the half move clock is reset
+      if ( bitbases_ && ( !plies_ || !board.clocks_[HALF_CLOCK] ) && bitbases_->probe(board, result) ) {
+         return board.color_ ? result : -result;
+      }
+      // a mate still wins on the fiftieth move, so drawn positions take the full listing
+      const bool drawn = board.clocks_[HALF_CLOCK] >= FIFTY_MOVES_CLOCK || history_.repetitions(board.clocks_[HALF_CLOCK]);
+      ChessMove move;
+      if ( !sampling_ || drawn || !sample(board, rng, move) ) {
+         board.listMoves(moves_);
+         if ( moves_.empty() ) {
+            return board.check(board.color_) ? ( board.color_ ? -1 : +1 ) : 0;
+         }
+         if ( drawn ) {
+            return 0;
+         }
+         move = moves_[rng.below(moves_.size())];
+      }
+      board.applyMove(move.from, move.to, move.promoteTo);
+      history_.push(board);
+   }
+}
@@ -0,0 +1,47 @@
+#ifndef PLAYOUT_H
+#define PLAYOUT_H
+
+#include "bitbase.hpp"
+#include "primitives.hpp"
+
+constexpr unsigned char FIFTY_MOVES_CLOCK = 100;
+constexpr unsigned MAX_TARGETS = 27;
+constexpr unsigned SAMPLE_ATTEMPTS = 32;
+const std::array<ChessFigure, 4> PROMOTIONS = {ChessFigure::Knight, ChessFigure::Bishop, ChessFigure::Rook, ChessFigure::Queen};
+
+// Squares a figure could reach on an empty board, the candidate moves of the sampling playouts.
+struct TargetTables {
+   struct Targets {
+      unsigned char size = 0;
+      std::array<unsigned char, MAX_TARGETS> squares;
+   };
+   TargetTables();
+   std::array<std::array<Targets, NUMBER_OF_SQUARES>, 2> pawns; // by color
+   std::array<std::array<Targets, NUMBER_OF_SQUARES>, 7> pieces; // by ChessFigure
+};
+const TargetTables TARGETS;
+
+// Uniformly random game continuation, the Monte-Carlo sample.
+class Playout {
+public:
+   explicit Playout(const Bitbases* bitbases = nullptr) : bitbases_(bitbases) {}
+
+   // +1: white wins, -1: black wins, 0: draw, the first repetition is already a draw
+   int run(ChessBoard board, Random& rng, const PositionHistory* history = nullptr);
+   unsigned plies() const { return plies_; }
+   // instead of listing every move, draw candidates until one is legal
+   void setSampling(bool sampling) { sampling_ = sampling; }
+   // uniform over the legal moves, false if SAMPLE_ATTEMPTS candidates were rejected
+   bool sample(const ChessBoard& board, Random& rng, ChessMove& move);
+
+private:
+   const Bitbases* bitbases_;
+   bool sampling_ = false;
+   std::array<unsigned char, NUMBER_OF_SQUARES> pieces_;
+   std::array<unsigned, NUMBER_OF_SQUARES> bounds_; // running sum of the candidates of the pieces
+   ChessMoveVector moves_;
+   PositionHistory history_;
+   unsigned plies_ = 0;
+};
+
+#endif /* PLAYOUT_H */
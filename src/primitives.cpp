@@ -1,6 +1,8 @@
 #include "primitives.hpp"
 
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
 #include <valgrind/callgrind.h>
 
 const Pos KNIGHT_FIRST_DIR(+1,+2);
@@ -15,13 +17,20 @@ Pos::isInDir( const Pos& dir ) const {
    return row == z * dir.row && col == z * dir.col && z > 0;
 }
 
+// the FEN fields end at a blank or at the end of the string
+static bool
+fieldEnd(char elem) {
+   return !elem || isspace(elem);
+}
+
+template <class Storage>
 bool
-ChessBoard::initFEN(const std::string& fen, const std::string& white, const std::string& casts, const std::string& enpassant, unsigned char halfMoveClock, unsigned char fullClock) {
-   for ( auto& elem : data_ ) {
-      elem.clear();
-   }
+ChessBoardT<Storage>::initFEN(const char* fen, const char* white, const char* casts, const char* enpassant, unsigned char halfMoveClock, unsigned char fullClock) {
+   data_.clear();
+   hash_ = 0;
    Pos pos(NUMBER_OF_ROWS-1, 0);
-   for ( const char elem : fen ) {
+   for ( ; !fieldEnd(*fen); fen++ ) {
+      const char elem = *fen;
       if ( elem == '/' ) {
          pos.prevRow();
       } else if ( isdigit(elem) ) {
@@ -38,39 +47,63 @@ ChessBoard::initFEN(const std::string& fen, const std::string& white, const std:
    if ( white[0] != 'w' && white[0] != 'b' ) {
       return false;
    }
-   color_ = ( white.size() >= 1 && white[0] == 'w' );
+   color_ = ( white[0] == 'w' );
    casts_ = {CHAR_INVALID, CHAR_INVALID, CHAR_INVALID, CHAR_INVALID};
-   std::array<unsigned, 2> cpos = {0, 0};
-   for ( const auto& elem : casts ) {
+   for ( ; !fieldEnd(*casts); casts++ ) {
+      const char elem = *casts;
       if ( elem == CHAR_INVALID ) {
          continue;
       }
       bool color = isupper(elem);
-      if ( cpos[color] >= CASTS_SIDES ) {
+      char col = toupper(elem);
+      if ( col == 'K' || col == 'Q' ) { // KQkq means the outermost rook of that side
+         const int dir = col == 'K' ? -1 : +1;
+         for ( col = ( col == 'K' ? 'H' : 'A' ); col >= 'A' && col <= 'H'; col += dir ) {
+            if ( getSquare(Pos(color ? FIRST_ROW : LAST_ROW, col - 'A')) == ChessSquare(ChessFigure::Rook, color) ) {
+               break;
+            }
+         }
+      }
+      const unsigned idx = (color ? 0 : CASTS_SIDES) + ( col - 'A' > kings_[color].col );
+      if ( col < 'A' || col > 'H' || casts_[idx] != CHAR_INVALID ) {
          return false;
       }
-      casts_[(color ? 0 : CASTS_SIDES) + cpos[color]] = elem;
-      cpos[color]++;
+      casts_[idx] = color ? col : tolower(col);
    }
-   enpassant_ = enpassant.size() >= 1 ? enpassant[0] : CHAR_INVALID;
+   enpassant_ = !fieldEnd(enpassant[0]) ? enpassant[0] : CHAR_INVALID;
    clocks_[HALF_CLOCK] = halfMoveClock;
    clocks_[FULL_CLOCK] = fullClock;
    return validHeavy();
 }
 
+template <class Storage>
+bool
+ChessBoardT<Storage>::initFEN(const std::string& str) {
+   return initFEN(str.c_str());
+}
+
+template <class Storage>
 bool
-ChessBoard::initFEN(const std::string& str) {
-   std::string fen, white, casts, enpassant;
-   unsigned halfMoveClock, fullClock;
-   std::stringstream(str) >> fen >> white >> casts >> enpassant >> halfMoveClock >> fullClock;
-   return initFEN(fen, white, casts, enpassant, halfMoveClock, fullClock);
+ChessBoardT<Storage>::initFEN(const char* str) {
+   // the fields are read where they stand, the C API parses without allocating
+   const char* fields[4];
+   for ( auto& field : fields ) {
+      for ( ; isspace(*str); str++ );
+      field = str;
+      for ( ; !fieldEnd(*str); str++ );
+   }
+   char* end = nullptr;
+   const unsigned halfMoveClock = strtoul(str, &end, 10);
+   const unsigned fullClock = strtoul(end, &end, 10);
+   return initFEN(fields[0], fields[1], fields[2], fields[3], halfMoveClock, fullClock);
 }
 
+template <class Storage>
 bool
-ChessBoard::validHeavy() const {
+ChessBoardT<Storage>::validHeavy() const {
    for ( const auto& color : COLORS ) {
       auto ksq = getSquare(kings_[color]);
-      if ( count(ChessSquare(ChessFigure::King, color)) != 1 || !kings_[color].valid() || ksq.figure() != ChessFigure::King || ksq.color() != color || data_[color ? LAST_ROW : FIRST_ROW].count(ChessSquare(ChessFigure::Pawn, color)) ) {
+      if ( count(ChessSquare(ChessFigure::King, color)) != 1 || !kings_[color].valid() || ksq.figure() != ChessFigure::King || ksq.color() != color || count(ChessSquare(ChessFigure::Pawn, color), color ? LAST_ROW : FIRST_ROW) ) {
          return false;
       }
       for ( unsigned i = 0; i < CASTS_SIDES; i++ ) {
@@ -84,8 +117,9 @@ ChessBoard::validHeavy() const {
    return !check(!color_);
 }
 
+template <class Storage>
 bool
-ChessBoard::isMoveValidInternal(const Pos& from, const Pos& to, const ChessFigure& sfig) const {
+ChessBoardT<Storage>::isMoveValidInternal(const Pos& from, const Pos& to, const ChessFigure& sfig) const {
    switch ( sfig ) {
       case ChessFigure::Pawn:
          if ( to.sub(from).isDiagonal() ) {
@@ -123,8 +157,9 @@ ChessBoard::isMoveValidInternal(const Pos& from, const Pos& to, const ChessFigur
    }
 }
 
+template <class Storage>
 bool
-ChessBoard::testCastleWalk(const Pos& from, const Pos& to, int row, int source, int target, bool king) const {
+ChessBoardT<Storage>::testCastleWalk(const Pos& from, const Pos& to, int row, int source, int target, bool king) const {
    for ( int lcol = std::min(source, target); lcol <= std::max(source, target); lcol++ ) {
       // is vacant?
       Pos lpos(row, lcol);
@@ -135,20 +170,22 @@ ChessBoard::testCastleWalk(const Pos& from, const Pos& to, int row, int source,
    return true;
 }
 
+template <class Storage>
 bool
-ChessBoard::isCastleValid(const Pos& from, const Pos& to) const {
+ChessBoardT<Storage>::isCastleValid(const Pos& from, const Pos& to) const {
    auto row = color_ ? FIRST_ROW : LAST_ROW;
    return from.row == int(row) && to.row == int(row)
        && testCastleWalk(from, to, row, from.col, to.col < from.col ? LONG_CASTLE_KING : SHORT_CASTLE_KING, true)
        && testCastleWalk(from, to, row, to.col,   to.col < from.col ? LONG_CASTLE_ROOK : SHORT_CASTLE_ROOK, false);
 }
 
+template <class Storage>
 bool
-ChessBoard::isMoveValid(const Pos& from, const Pos& to, bool pinned, unsigned char checkDanger) const {
+ChessBoardT<Storage>::isMoveValid(const Pos& from, const Pos& to, bool pinned, unsigned char checkDanger) const {
    if ( !from.valid() || !to.valid() || from == to ) {
       return false;
    }
-   if ( pinned && !to.sub(from).isInDir(from.sub(kings_[color_]).dir()) ) {
+   if ( pinned && !to.sub(from).isInDir(from.sub(kings_[color_]).dir()) && !from.sub(to).isInDir(from.sub(kings_[color_]).dir()) ) {
       return false;
    }
    const auto ssq = getSquare(from);
@@ -169,19 +206,29 @@ ChessBoard::isMoveValid(const Pos& from, const Pos& to, bool pinned, unsigned ch
    if ( ssq.figure() == ChessFigure::Pawn && !( to.sub(from).isDiagonal() ? (!tsq.empty() || isEnpassantTarget(to)) : tsq.empty() ) ) {
       return false;
    }
-   // 3. if the king is in check then the piece must block the check
+   // 3. en passant removes two pawns from the same row, hard to see without trying
+   if ( ssq.figure() == ChessFigure::Pawn && tsq.empty() && isEnpassantTarget(to) ) {
+      ChessBoardT next = *this;
+      next.applyMove(from, to);
+      return !next.check(color_);
+   }
+   // 4. if the king is in check then the piece must block the check
    if ( ssq.figure() != ChessFigure::King && checkDanger && countWatchers(!color_, kings_[color_], 1, to) ) {
       return false;
    }
-   // 4. the king cannot step into a check
-   if ( ssq.figure() == ChessFigure::King && ( hasWatcher(!color_, to) || getWatcherFromLine(!color_, from, from.sub(to)).valid() ) ) {
-      return false;
+   // 5. the king cannot step into a check, not even by stepping away from a line attacker
+   if ( ssq.figure() == ChessFigure::King ) {
+      const auto wsq = getSquare(getWatcherFromLine(!color_, from, from.sub(to)));
+      if ( hasWatcher(!color_, to) || ( !wsq.empty() && wsq.figure() != ChessFigure::Pawn && wsq.figure() != ChessFigure::King ) ) {
+         return false;
+      }
    }
    return true;
 }
 
+template <class Storage>
 Pos
-ChessBoard::getPieceFromLine(const Pos& pos, const Pos& dir) const {
+ChessBoardT<Storage>::getPieceFromLine(const Pos& pos, const Pos& dir) const {
    Pos acc = pos.add(dir);
 
    // Bishop, Rook, Queen
@@ -191,8 +238,9 @@ ChessBoard::getPieceFromLine(const Pos& pos, const Pos& dir) const {
    return acc;
 }
 
+template <class Storage>
 Pos
-ChessBoard::getWatcherFromLine(bool attackerColor, const Pos& pos, const Pos& dir) const {
+ChessBoardT<Storage>::getWatcherFromLine(bool attackerColor, const Pos& pos, const Pos& dir) const {
    Pos acc = getPieceFromLine(pos, dir);
    if ( acc.valid() ) {
       auto sq = getSquare(acc);
@@ -211,8 +259,9 @@ ChessBoard::getWatcherFromLine(bool attackerColor, const Pos& pos, const Pos& di
    return Pos::INVALID();
 }
 
+template <class Storage>
 unsigned char
-ChessBoard::countWatchers(bool attackerColor, const Pos& pos, unsigned char maxval, const Pos& newBlocker, Pos& attackerPos) const {
+ChessBoardT<Storage>::countWatchers(bool attackerColor, const Pos& pos, unsigned char maxval, const Pos& newBlocker, Pos& attackerPos) const {
    unsigned char retval = 0;
    if ( !pos.valid() ) {
       return retval;
@@ -256,14 +305,16 @@ ChessBoard::countWatchers(bool attackerColor, const Pos& pos, unsigned char maxv
    return retval;
 }
 
+template <class Storage>
 unsigned char
-ChessBoard::countWatchers(const bool color, const Pos& pos, unsigned char maxval, const Pos& newBlocker) const {
+ChessBoardT<Storage>::countWatchers(const bool color, const Pos& pos, unsigned char maxval, const Pos& newBlocker) const {
    Pos attacker = Pos::INVALID();
    return countWatchers(color, pos, maxval, newBlocker, attacker);
 }
 
+template <class Storage>
 bool
-ChessBoard::isPinned(const Pos& pos) const {
+ChessBoardT<Storage>::isPinned(const Pos& pos) const {
    Pos dir = pos.sub(kings_[color_]).dir();
    if ( dir.null() ) {
       return false;
@@ -286,8 +337,9 @@ IsFigureChar(char chr) {
    return chr != ' ' && FIGURE_CONVERTER_SAFE.find(chr) != std::string::npos;
 }
 
+template <class Storage>
 bool
-ChessBoard::move(const std::string& desc) {
+ChessBoardT<Storage>::move(const std::string& desc) {
    if ( !valid() ) {
       return false;
    }
@@ -390,8 +442,9 @@ ChessBoard::move(const std::string& desc) {
    return false;
 }
 
+template <class Storage>
 void
-ChessBoard::applyMove(const Pos& from, const Pos& to, const ChessFigure promoteTo) {
+ChessBoardT<Storage>::applyMove(const Pos& from, const Pos& to, const ChessFigure promoteTo) {
    const auto ssq = getSquare(from);
 
    unsigned sofs = (ssq.color() ? 0 : CASTS_SIDES);
@@ -406,6 +459,11 @@ ChessBoard::applyMove(const Pos& from, const Pos& to, const ChessFigure promoteT
          casts_[sofs+1] = CHAR_INVALID;
       }
    }
+   for ( unsigned i = CASTS_SIDES - sofs; i < NUMBER_OF_CASTS - sofs; i++ ) { // a captured rook cannot castle
+      if ( getCastPos(i) == to ) {
+         casts_[i] = CHAR_INVALID;
+      }
+   }
 
    const auto tsq = getSquare(to);
    if ( ssq == ChessSquare(ChessFigure::King, tsq.color()) && tsq.figure() == ChessFigure::Rook ) { // castling
@@ -422,7 +480,7 @@ ChessBoard::applyMove(const Pos& from, const Pos& to, const ChessFigure promoteT
       }
    }
 
-   if ( isEnpassantTarget(to) ) {
+   if ( ssq.figure() == ChessFigure::Pawn && isEnpassantTarget(to) ) {
       set(to.towardCenter(), ChessSquare());
    }
 
@@ -441,8 +499,9 @@ ChessBoard::applyMove(const Pos& from, const Pos& to, const ChessFigure promoteT
    enpassant_ = isFastPawn(from, to, ssq.figure()) ? to.pcol() : CHAR_INVALID;
 }
 
+template <class Storage>
 bool
-ChessBoard::move(const Pos& from, const Pos& to, const ChessFigure promoteTo) {
+ChessBoardT<Storage>::move(const Pos& from, const Pos& to, const ChessFigure promoteTo) {
    if ( promoteTo == ChessFigure::Pawn || !isMoveValid(from, to) ) {
       return false;
    }
@@ -469,8 +528,9 @@ intersect(const Pos& pos, const Pos& dir, const Pos& king, const Pos& checker) {
    return pos.add(dir.mul(aval));
 }
 
+template <class Storage>
 bool
-ChessBoard::isMobilePiece(const Pos& pos, const ChessFigure& sfig, unsigned char check, const Pos& checker) const {
+ChessBoardT<Storage>::isMobilePiece(const Pos& pos, const ChessFigure& sfig, unsigned char check, const Pos& checker) const {
    bool pinned = sfig != ChessFigure::King && isPinned(pos);
    bool easy = !pinned && !check;
    switch ( sfig ) {
@@ -485,15 +545,16 @@ ChessBoard::isMobilePiece(const Pos& pos, const ChessFigure& sfig, unsigned char
                   return true;
                }
             }
+            dir = Pos(2, 0); // a fast pawn can block a check where the slow one cannot
+            return check && isMoveValid(pos, color_ ? pos.add(dir) : pos.sub(dir), pinned, check);
          }
-         return false;
       case ChessFigure::Knight:
          {
             if ( !pinned ) {
                Pos kpos = color_ ? pos.add(KNIGHT_FIRST_DIR) : pos.sub(KNIGHT_FIRST_DIR);
                Pos kshift = color_ ? KNIGHT_FIRST_SHIFT : KNIGHT_FIRST_SHIFT.neg();
                for ( size_t i = 0; i < 8; i ++ ) {
-                  if ( kpos.valid() && ( easy ? isEmpty(kpos) : isMoveValid(pos, kpos, pinned, check) ) ) {
+                  if ( kpos.valid() && ( easy ? ( isEmpty(kpos) || getSquare(kpos).color() != color_ ) : isMoveValid(pos, kpos, pinned, check) ) ) {
                      return true;
                   }
                   kpos.move(kshift);
@@ -549,18 +610,28 @@ ChessBoard::isMobilePiece(const Pos& pos, const ChessFigure& sfig, unsigned char
    return false;
 }
 
+template <class Storage>
 void
-ChessBoard::listMobilePieces(MiniPosVector& pawns, MiniPosVector& pieces) const {
-   pawns.clear();
-   pieces.clear();
+ChessBoardT<Storage>::listMobilePieces(MiniPosVector& pawns, MiniPosVector& pieces) const {
+   MobilePieces mobile;
+   listMobilePieces(mobile);
+   pawns = mobile.pawns;
+   pieces = mobile.pieces;
+}
+
+template <class Storage>
+void
+ChessBoardT<Storage>::listMobilePieces(MobilePieces& mobile) const {
+   mobile.pawns.clear();
+   mobile.pieces.clear();
+   mobile.check = 0;
 
    if ( valid() ) {
       // There ways to solve a check: a.) move with the king b.) block with another piece c.) capture the attacker
-      Pos checker;
-      unsigned int cktype = getChecker(color_, checker);
-      if ( cktype == 2 ) { // double check: the king must move / take
-         if ( isMobilePiece(kings_[color_], ChessFigure::King, cktype, checker) ) {
-            push_back(pieces, kings_[color_]);
+      mobile.check = getChecker(color_, mobile.checker);
+      if ( mobile.check == 2 ) { // double check: the king must move / take
+         if ( isMobilePiece(kings_[color_], ChessFigure::King, mobile.check, mobile.checker) ) {
+            push_back(mobile.pieces, kings_[color_]);
          }
       } else {
          Pos pos;
@@ -568,8 +639,8 @@ ChessBoard::listMobilePieces(MiniPosVector& pawns, MiniPosVector& pieces) const
             for ( pos.col = 0; pos.col < NUMBER_OF_COLS; pos.col++ ) {
                auto psq = getSquareUnsafe(pos);
                if ( !psq.empty() && psq.color() == color_ ) {
-                  if ( isMobilePiece(pos, psq.figure(), cktype, checker) ) {
-                     push_back(psq.figure() == ChessFigure::Pawn ? pawns : pieces, pos);
+                  if ( isMobilePiece(pos, psq.figure(), mobile.check, mobile.checker) ) {
+                     push_back(psq.figure() == ChessFigure::Pawn ? mobile.pawns : mobile.pieces, pos);
                   }
                }
             }
@@ -578,8 +649,302 @@ ChessBoard::listMobilePieces(MiniPosVector& pawns, MiniPosVector& pieces) const
    }
 }
 
+template <class Storage>
 void
-ChessBoard::debugPrint(std::ostream& os) const {
+ChessBoardT<Storage>::listMobilePieces(const ChessBoardT& prev, const MobilePieces& prevMobile, MobilePieces& mobile) const {
+   if ( !valid() || prev.color_ != color_ || !( prev.kings_[color_] == kings_[color_] ) || !prevMobile.complete() || prevMobile.check ) {
+      listMobilePieces(mobile);
+      return;
+   }
+   Pos checker;
+   const unsigned char check = getChecker(color_, checker);
+   if ( check ) {
+      listMobilePieces(mobile);
+      return;
+   }
+
+   // without a check a piece only looks at its neighbour squares, its knight jumps and its pin
+   unsigned long long affected = 0;
+   auto mark = [&](const Pos& pos) {
+      if ( pos.valid() ) {
+         affected |= 1ULL << pos.code();
+      }
+   };
+   const Pos king = kings_[color_];
+   std::array<bool, 9> lines = {}; // of the king, by direction, where a pin may have come or gone
+   Pos pos;
+   for ( pos.row = 0; pos.row < NUMBER_OF_ROWS; pos.row++ ) {
+      if ( data_.rowEquals(prev.data_, pos.row) ) {
+         continue;
+      }
+      for ( pos.col = 0; pos.col < NUMBER_OF_COLS; pos.col++ ) {
+         if ( getSquareUnsafe(pos) == prev.getSquareUnsafe(pos) ) {
+            continue;
+         }
+         const Pos line = pos.sub(king).dir();
+         if ( !line.null() ) {
+            lines[(line.row + 1) * 3 + line.col + 1] = true;
+         }
+         Pos dir;
+         for ( dir.row = -1; dir.row <= +1; dir.row++ ) {
+            for ( dir.col = -1; dir.col <= +1; dir.col++ ) {
+               mark(pos.add(dir));
+            }
+         }
+         Pos kpos = pos.add(KNIGHT_FIRST_DIR);
+         Pos kshift = KNIGHT_FIRST_SHIFT;
+         for ( size_t i = 0; i < 8; i ++ ) {
+            mark(kpos);
+            kpos.move(kshift);
+            kshift.knightShiftRot();
+         }
+      }
+   }
+   // pawns that could take or now can take en passant
+   for ( auto elem : { prev.enpassant_, enpassant_ } ) {
+      if ( elem != CHAR_INVALID ) {
+         const Pos target = Pos(color_ ? LAST_EMP_ROW : FIRST_EMP_ROW, elem - 'a').towardCenter();
+         mark(target.add(Pos(0, -1)));
+         mark(target.add(Pos(0, +1)));
+      }
+   }
+   Pos dir;
+   for ( dir.row = -1; dir.row <= +1; dir.row++ ) {
+      for ( dir.col = -1; dir.col <= +1; dir.col++ ) {
+         for ( Pos acc = king.add(dir); lines[(dir.row + 1) * 3 + dir.col + 1] && !dir.null() && acc.valid(); acc.move(dir) ) {
+            mark(acc);
+         }
+      }
+   }
+   mark(king);
+
+   unsigned long long candidates = affected;
+   for ( size_t i = 0; i < prevMobile.pawns.size(); i++ ) {
+      candidates |= 1ULL << prevMobile.pawns.get(i);
+   }
+   for ( size_t i = 0; i < prevMobile.pieces.size(); i++ ) {
+      candidates |= 1ULL << prevMobile.pieces.get(i);
+   }
+   mobile.pawns.clear(); // may be the same as the previous ones
+   mobile.pieces.clear();
+   mobile.check = check;
+   mobile.checker = checker;
+   for ( ; candidates; candidates &= candidates - 1 ) {
+      const unsigned code = __builtin_ctzll(candidates);
+      const Pos pos = PosFromCode(code);
+      const auto psq = getSquareUnsafe(pos);
+      if ( !( affected >> code & 1 ) || ( !psq.empty() && psq.color() == color_ && isMobilePiece(pos, psq.figure(), check, checker) ) ) {
+         push_back(psq.figure() == ChessFigure::Pawn ? mobile.pawns : mobile.pieces, pos);
+      }
+   }
+}
+
+template <class Storage>
+template <class Moves>
+void
+ChessBoardT<Storage>::addMoves(const Pos& from, unsigned char check, Moves& moves) const {
+   const auto sfig = getSquareUnsafe(from).figure();
+   const bool pinned = sfig != ChessFigure::King && isPinned(from);
+   std::array<unsigned char, 32> targets;
+   unsigned size = 0;
+   auto addTarget = [&](const Pos& to) {
+      if ( to.valid() && ( isEmpty(to) || getSquareUnsafe(to).color() != color_ ) ) {
+         targets[size++] = to.code();
+      }
+   };
+   Pos dir;
+   switch ( sfig ) {
+      case ChessFigure::Pawn:
+         dir = Pos(color_ ? +1 : -1, 0);
+         addTarget(from.add(dir));
+         addTarget(from.add(dir.mul(2)));
+         addTarget(from.add(dir).add(Pos(0, -1)));
+         addTarget(from.add(dir).add(Pos(0, +1)));
+         break;
+      case ChessFigure::Knight:
+         {
+            Pos kpos = from.add(KNIGHT_FIRST_DIR);
+            Pos kshift = KNIGHT_FIRST_SHIFT;
+            for ( size_t i = 0; i < 8; i ++ ) {
+               addTarget(kpos);
+               kpos.move(kshift);
+               kshift.knightShiftRot();
+            }
+         }
+         break;
+      case ChessFigure::King:
+         for ( dir.row = -1; dir.row <= +1; dir.row++ ) {
+            for ( dir.col = -1; dir.col <= +1; dir.col++ ) {
+               if ( !dir.null() ) {
+                  addTarget(from.add(dir));
+               }
+            }
+         }
+         if ( !check ) {
+            for ( unsigned i = 0; i < CASTS_SIDES; i++ ) {
+               auto rpos = getCastPos(color_, i);
+               if ( rpos.valid() ) {
+                  targets[size++] = rpos.code();
+               }
+            }
+         }
+         break;
+      default:
+         for ( dir.row = -1; dir.row <= +1; dir.row++ ) {
+            for ( dir.col = -1; dir.col <= +1; dir.col++ ) {
+               if ( dir.null() || sfig == ( dir.isAxialDir() ? ChessFigure::Bishop : ChessFigure::Rook ) ) {
+                  continue;
+               }
+               Pos acc = getPieceFromLine(from, dir);
+               for ( Pos to = from.add(dir); !(to == acc); to.move(dir) ) {
+                  targets[size++] = to.code();
+               }
+               addTarget(acc);
+            }
+         }
+   }
+   std::sort(targets.begin(), targets.begin() + size);
+   for ( unsigned i = 0; i < size; i++ ) {
+      const Pos to = PosFromCode(targets[i]);
+      if ( isMoveValid(from, to, pinned, check) ) {
+         if ( isPromotion(from, to, sfig) ) {
+            for ( auto fig : { ChessFigure::Knight, ChessFigure::Bishop, ChessFigure::Rook, ChessFigure::Queen } ) {
+               moves.push_back(ChessMove(from, to, fig));
+            }
+         } else {
+            moves.push_back(ChessMove(from, to));
+         }
+      }
+   }
+}
+
+template <class Storage>
+void
+ChessBoardT<Storage>::listMoves(const Pos& from, unsigned char check, ChessMoveVector& moves) const {
+   addMoves(from, check, moves);
+}
+
+template <class Storage>
+void
+ChessBoardT<Storage>::listMoves(ChessMoveVector& moves) const {
+   addMoves(moves);
+}
+
+template <class Storage>
+void
+ChessBoardT<Storage>::listMoves(ChessMoveArray& moves) const {
+   addMoves(moves);
+}
+
+template <class Storage>
+template <class Moves>
+void
+ChessBoardT<Storage>::addMoves(Moves& moves) const {
+   moves.clear();
+   Pos checker;
+   const unsigned char check = getChecker(color_, checker);
+   // walking the squares keeps the moves in a canonical order, and unlike listMobilePieces it has no limit on the number of pieces
+   Pos pos;
+   for ( pos.row = 0; pos.row < NUMBER_OF_ROWS; pos.row++ ) {
+      for ( pos.col = 0; pos.col < NUMBER_OF_COLS; pos.col++ ) {
+         const auto psq = getSquareUnsafe(pos);
+         if ( !psq.empty() && psq.color() == color_ && ( check < 2 || psq.figure() == ChessFigure::King ) && isMobilePiece(pos, psq.figure(), check, checker) ) {
+            addMoves(pos, check, moves);
+         }
+      }
+   }
+}
+
+template <class Storage>
+void
+ChessBoardT<Storage>::listMoves(const MobilePieces& mobile, ChessMoveVector& moves) const {
+   moves.clear();
+   const auto& pawns = mobile.pawns;
+   const auto& pieces = mobile.pieces;
+   // pieces are listed in square order, so merging the two lists keeps the moves in a canonical order
+   size_t i = 0;
+   size_t j = 0;
+   while ( i < pawns.size() || j < pieces.size() ) {
+      if ( j >= pieces.size() || ( i < pawns.size() && pawns.get(i) < pieces.get(j) ) ) {
+         listMoves(get(pawns, i++), mobile.check, moves);
+      } else {
+         listMoves(get(pieces, j++), mobile.check, moves);
+      }
+   }
+}
+
+SquareControl::SquareControl(const ChessBoard& board) : data_() {
+   Pos from;
+   for ( from.row = 0; from.row < NUMBER_OF_ROWS; from.row++ ) {
+      for ( from.col = 0; from.col < NUMBER_OF_COLS; from.col++ ) {
+         const auto psq = board.getSquareUnsafe(from);
+         if ( psq.empty() ) {
+            continue;
+         }
+         const bool color = psq.color();
+         const auto fig = psq.figure();
+         auto addValid = [&](const Pos& to) {
+            if ( to.valid() ) {
+               add(color, to, fig);
+            }
+         };
+         Pos dir;
+         switch ( fig ) {
+            case ChessFigure::Pawn:
+               addValid(from.add(Pos(color ? +1 : -1, -1)));
+               addValid(from.add(Pos(color ? +1 : -1, +1)));
+               break;
+            case ChessFigure::Knight:
+               {
+                  Pos kpos = from.add(KNIGHT_FIRST_DIR);
+                  Pos kshift = KNIGHT_FIRST_SHIFT;
+                  for ( size_t i = 0; i < 8; i ++ ) {
+                     addValid(kpos);
+                     kpos.move(kshift);
+                     kshift.knightShiftRot();
+                  }
+               }
+               break;
+            case ChessFigure::King:
+               for ( dir.row = -1; dir.row <= +1; dir.row++ ) {
+                  for ( dir.col = -1; dir.col <= +1; dir.col++ ) {
+                     if ( !dir.null() ) {
+                        addValid(from.add(dir));
+                     }
+                  }
+               }
+               break;
+            default:
+               for ( dir.row = -1; dir.row <= +1; dir.row++ ) {
+                  for ( dir.col = -1; dir.col <= +1; dir.col++ ) {
+                     if ( dir.null() || ( fig != ChessFigure::Queen && fig != dir.minorType() ) ) {
+                        continue;
+                     }
+                     // up to and including the first piece, like getWatcherFromLine there are no x-rays
+                     const Pos last = board.getPieceFromLine(from, dir);
+                     for ( Pos to = from.add(dir); !(to == last); to.move(dir) ) {
+                        add(color, to, fig);
+                     }
+                     addValid(last);
+                  }
+               }
+         }
+      }
+   }
+}
+
+bool
+SquareControl::hanging(const ChessBoard& board, const Pos& pos) const {
+   const auto psq = board.getSquareUnsafe(pos);
+   if ( psq.empty() || psq.figure() == ChessFigure::King || !count(!psq.color(), pos) ) {
+      return false;
+   }
+   return count(!psq.color(), pos) > count(psq.color(), pos) || least(!psq.color(), pos) < psq.figure();
+}
+
+template <class Storage>
+void
+ChessBoardT<Storage>::debugPrint(std::ostream& os) const {
    if ( !valid() ) {
       os << "!!!INVALID!!!" << std::endl;
       return;
@@ -588,7 +953,10 @@ ChessBoard::debugPrint(std::ostream& os) const {
       os << " ";
       debugPrintRowSeparator(os);
       os << int(row+1);
-      data_[row].debugPrint(os, BOARD_DRAW_COL_SEPARATOR);
+      for ( int col = 0; col < NUMBER_OF_COLS; col++ ) {
+         os << BOARD_DRAW_COL_SEPARATOR << getSquareUnsafe(Pos(row, col));
+      }
+      os << BOARD_DRAW_COL_SEPARATOR;
       os <<std::endl;
    }
    os << " ";
@@ -624,6 +992,19 @@ std::ostream& operator<<(std::ostream& os, const MiniPosVector& vec) {
    return os;
 }
 
+void
+ChessMove::debugPrint(std::ostream& os) const {
+   os << from << to;
+   if ( promoteTo != ChessFigure::None ) {
+      os << toChar(false, promoteTo);
+   }
+}
+
+std::ostream& operator<<(std::ostream& os, const ChessMove& move) {
+   move.debugPrint(os);
+   return os;
+}
+
 std::ostream& operator<<(std::ostream& os, const ChessSquare& sq) {
    os << toChar(sq);
    return os;
@@ -643,3 +1024,7 @@ std::ostream& operator<<(std::ostream& os, const Pos& pos) {
    pos.debugPrint(os);
    return os;
 }
+
+template struct ChessBoardT<NibbleRows>;
+template struct ChessBoardT<ByteMailbox>;
+template struct ChessBoardT<BitboardPlanes>;
@@ -1,14 +1,17 @@
 #ifndef PRIMITIVES_H
 #define PRIMITIVES_H
 
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <ostream>
 #include <sstream>
+#include <vector>
 
 constexpr int NUMBER_OF_ROWS = 8;
 constexpr int NUMBER_OF_COLS = 8;
 constexpr char NUMBER_OF_COLS_CHAR = 8;
+constexpr unsigned NUMBER_OF_SQUARES = NUMBER_OF_ROWS * NUMBER_OF_COLS;
 constexpr unsigned NUMBER_OF_CASTS = 4;
 constexpr unsigned NUMBER_OF_CLOCKS = 2;
 constexpr unsigned NUMBER_OF_KINGS = 2;
@@ -85,6 +88,18 @@ char toChar( const ChessSquare& sq ) {
    return toChar(sq.color(), sq.figure());
 }
 
+struct Random {
+   explicit Random(unsigned long long seed = 1) : state_(seed ? seed : 1) {}
+   unsigned long long next() {
+      state_ ^= state_ >> 12;
+      state_ ^= state_ << 25;
+      state_ ^= state_ >> 27;
+      return state_ * 2685821657736338717ULL;
+   }
+   unsigned below(unsigned n) { return next() % n; }
+   unsigned long long state_;
+};
+
 template <class T> inline T tabs(const T& v) { return v >= 0 ? v : -v; }
 template <class T> inline T tsgn(const T& v) { return v ? ( v >= 0 ? +1 :-1 ) : 0; }
 
@@ -141,6 +156,15 @@ public:
    static constexpr size_t CAPACITY = (sizeof(unsigned long) * BITS_IN_A_BYTE - BITS_FOR_SIZE) / BITS;
    static constexpr unsigned long BITMASK = (1 << BITS)-1;
    unsigned char size() const { return get(CAPACITY); }
+   bool full() const { return unsigned(size() + 1) >= CAPACITY; }
+   bool equals(const MiniVector& rhs) const {
+      for ( size_t i = 0; i < size(); i++ ) {
+         if ( get(i) != rhs.get(i) ) {
+            return false;
+         }
+      }
+      return size() == rhs.size();
+   }
    unsigned char get(size_t i) const { return (storage_ >> (BITS * i)) & BITMASK; }
    void clear() { storage_ = 0; }
    void set(size_t i, unsigned char num) { storage_ = (storage_ & ~(BITMASK << (BITS*i))) | static_cast<unsigned long>(num & BITMASK) << (BITS*i); }
@@ -169,6 +193,65 @@ void set(MiniPosVector& vec, size_t i, const Pos& pos) { vec.set(i, pos.code());
 void push_back(MiniPosVector& vec, const Pos& pos) { vec.push_back(pos.code()); }
 std::ostream& operator<<(std::ostream& os, const MiniPosVector& vec);
 
+struct ChessMove {
+   constexpr ChessMove(const Pos& pfrom = Pos::INVALID(), const Pos& pto = Pos::INVALID(), ChessFigure ppromoteTo = ChessFigure::None) : from(pfrom), to(pto), promoteTo(ppromoteTo) {}
+   bool equals( const ChessMove& rhs ) const { return from == rhs.from && to == rhs.to && promoteTo == rhs.promoteTo; }
+   void debugPrint(std::ostream& os) const;
+   Pos from;
+   Pos to;
+   ChessFigure promoteTo;
+};
+
+std::ostream& operator<<(std::ostream& os, const ChessMove& move);
+bool operator==( const ChessMove& lhs, const ChessMove& rhs ) { return lhs.equals(rhs); }
+typedef std::vector<ChessMove> ChessMoveVector;
+
+constexpr size_t MAX_LEGAL_MOVES = 256; // no reachable position has more than 218
+
+// Move list of a fixed capacity for the callers that must not allocate, the moves beyond it are dropped and noted.
+class ChessMoveArray {
+public:
+   void clear() { size_ = 0; overflow_ = false; }
+   void push_back(const ChessMove& move) {
+      if ( size_ < MAX_LEGAL_MOVES ) {
+         moves_[size_++] = move;
+      } else {
+         overflow_ = true;
+      }
+   }
+   size_t size() const { return size_; }
+   bool overflow() const { return overflow_; }
+   const ChessMove* begin() const { return moves_.data(); }
+   const ChessMove* end() const { return moves_.data() + size_; }
+private:
+   std::array<ChessMove, MAX_LEGAL_MOVES> moves_;
+   size_t size_ = 0;
+   bool overflow_ = false;
+};
+
+struct ZobristKeys {
+   ZobristKeys() {
+      Random rng;
+      for ( auto& elem : squares ) {
+         for ( unsigned char data = 0; data < elem.size(); data++ ) {
+            elem[data] = ChessSquare(data).empty() ? 0 : rng.next();
+         }
+      }
+      for ( auto& elem : casts ) {
+         elem = rng.next();
+      }
+      for ( auto& elem : enpassant ) {
+         elem = rng.next();
+      }
+      color = rng.next();
+   }
+   std::array<std::array<unsigned long long, 16>, NUMBER_OF_ROWS * NUMBER_OF_COLS> squares;
+   std::array<unsigned long long, NUMBER_OF_CASTS * NUMBER_OF_COLS> casts;
+   std::array<unsigned long long, NUMBER_OF_COLS> enpassant;
+   unsigned long long color;
+};
+const ZobristKeys ZOBRIST;
+
 struct ChessRow {
    ChessRow() : data_() {}
 
@@ -177,6 +260,14 @@ struct ChessRow {
 
    ChessSquare getSquare(unsigned char col) const { return data_[col >> 1].get(col & 1); }
    bool isEmpty(unsigned char col) const { return getSquare(col).empty(); }
+   bool equals(const ChessRow& rhs) const {
+      for ( size_t i = 0; i < data_.size(); i++ ) {
+         if ( data_[i].data_ != rhs.data_[i].data_ ) {
+            return false;
+         }
+      }
+      return true;
+   }
    unsigned count(const ChessSquare& tsq) const {
       unsigned retval = 0;
       for ( int col = 0; col < NUMBER_OF_COLS; col++ ) {
@@ -199,11 +290,79 @@ struct ChessRow {
 
 std::ostream& operator<<(std::ostream& os, const ChessRow& row);
 
-struct ChessBoard {
-   ChessBoard() : data_(), color_(INVALID_MARKER), casts_({CHAR_INVALID, CHAR_INVALID, CHAR_INVALID, CHAR_INVALID}), enpassant_(CHAR_INVALID), clocks_({0,0}), kings_({Pos::INVALID(), Pos::INVALID()}) {}
+// Square storages of ChessBoardT, each one with getSquare, isEmpty, set, clear and rowEquals.
+
+// Two squares a byte, the smallest board to copy.
+struct NibbleRows {
+   void clear() {
+      for ( auto& elem : rows_ ) {
+         elem.clear();
+      }
+   }
+   ChessSquare getSquare(const Pos& pos) const { return rows_[pos.row].getSquare(pos.col); }
+   bool isEmpty(const Pos& pos) const { return rows_[pos.row].isEmpty(pos.col); }
+   void set(const Pos& pos, const ChessSquare& sq) { rows_[pos.row].set(pos.col, sq); }
+   bool rowEquals(const NibbleRows& rhs, int row) const { return rows_[row].equals(rhs.rows_[row]); }
+
+   std::array<ChessRow, NUMBER_OF_ROWS> rows_;
+};
+
+// A byte a square, nothing to shift or mask on access.
+struct ByteMailbox {
+   void clear() { squares_.fill(ChessSquare()); }
+   ChessSquare getSquare(const Pos& pos) const { return squares_[pos.code()]; }
+   bool isEmpty(const Pos& pos) const { return squares_[pos.code()].empty(); }
+   void set(const Pos& pos, const ChessSquare& sq) { squares_[pos.code()] = sq; }
+   bool rowEquals(const ByteMailbox& rhs, int row) const {
+      return std::equal(squares_.begin() + row * NUMBER_OF_COLS, squares_.begin() + ( row + 1 ) * NUMBER_OF_COLS, rhs.squares_.begin() + row * NUMBER_OF_COLS,
+                        [](const ChessSquare& lhs, const ChessSquare& rhs) { return lhs.data_ == rhs.data_; });
+   }
+
+   std::array<ChessSquare, NUMBER_OF_SQUARES> squares_;
+};
+
+// Bit i of the square codes in bitboard i, a square is empty when none of its figure bits is set.
+struct BitboardPlanes {
+   void clear() { planes_.fill(0); }
+   ChessSquare getSquare(const Pos& pos) const {
+      const unsigned code = pos.code();
+      return ChessSquare(( planes_[0] >> code & 1 ) | ( planes_[1] >> code & 1 ) << 1 | ( planes_[2] >> code & 1 ) << 2 | ( planes_[3] >> code & 1 ) << 3);
+   }
+   bool isEmpty(const Pos& pos) const { return !( occupied() >> pos.code() & 1 ); }
+   void set(const Pos& pos, const ChessSquare& sq) {
+      const unsigned long long bit = 1ULL << pos.code();
+      for ( unsigned i = 0; i < planes_.size(); i++ ) {
+         planes_[i] = ( planes_[i] & ~bit ) | ( sq.data() >> i & 1 ? bit : 0 );
+      }
+   }
+   bool rowEquals(const BitboardPlanes& rhs, int row) const {
+      unsigned long long diff = 0;
+      for ( unsigned i = 0; i < planes_.size(); i++ ) {
+         diff |= planes_[i] ^ rhs.planes_[i];
+      }
+      return !( diff >> ( row * NUMBER_OF_COLS ) & 0xFF );
+   }
+   unsigned long long occupied() const { return planes_[1] | planes_[2] | planes_[3]; }
+
+   std::array<unsigned long long, 4> planes_;
+};
+
+// Mobile pieces of the side to move and the check they were listed in.
+struct MobilePieces {
+   bool complete() const { return !pawns.full() && !pieces.full(); }
+   MiniPosVector pawns;
+   MiniPosVector pieces;
+   unsigned char check = 0;
+   Pos checker;
+};
 
-   bool initFEN(const std::string& fen, const std::string& white, const std::string& casts, const std::string& enpassant, unsigned char halfMoveClock, unsigned char fullClock); 
+template <class Storage>
+struct ChessBoardT {
+   ChessBoardT() : data_(), color_(INVALID_MARKER), casts_({CHAR_INVALID, CHAR_INVALID, CHAR_INVALID, CHAR_INVALID}), enpassant_(CHAR_INVALID), clocks_({0,0}), kings_({Pos::INVALID(), Pos::INVALID()}), hash_(0) {}
+
+   bool initFEN(const char* fen, const char* white, const char* casts, const char* enpassant, unsigned char halfMoveClock, unsigned char fullClock);
    bool initFEN(const std::string& str);
+   bool initFEN(const char* str);
 
    void init() {
       assert( initFEN("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR", "w", "AHah", "-", 0, 1) );
@@ -222,12 +381,13 @@ struct ChessBoard {
       }
       os << BOARD_DRAW_CORNER << std::endl;
    }
-   ChessSquare getSquare(const Pos& pos) const { return pos.valid() ? data_[pos.row].getSquare(pos.col) : ChessSquare(); }
-   ChessSquare getSquareUnsafe(const Pos& pos) const { return data_[pos.row].getSquare(pos.col); }
-   bool isEmpty(const Pos& pos) const { return data_[pos.row].isEmpty(pos.col); }
+   ChessSquare getSquare(const Pos& pos) const { return pos.valid() ? data_.getSquare(pos) : ChessSquare(); }
+   ChessSquare getSquareUnsafe(const Pos& pos) const { return data_.getSquare(pos); }
+   bool isEmpty(const Pos& pos) const { return data_.isEmpty(pos); }
    void set(const Pos& pos, const ChessSquare& sq) {
       assert( pos.row >= 0 && pos.row < NUMBER_OF_ROWS );
-      data_[pos.row].set(pos.col, sq);
+      hash_ ^= ZOBRIST.squares[pos.code()][getSquareUnsafe(pos).data()] ^ ZOBRIST.squares[pos.code()][sq.data()];
+      data_.set(pos, sq);
       if ( sq.figure() == ChessFigure::King ) {
          kings_[sq.color()] = pos;
       }
@@ -256,10 +416,41 @@ struct ChessBoard {
    bool check(bool color) const { return countWatchers(!color, kings_[color], 1); }
    unsigned char getChecker(bool color, Pos& pos) const { return countWatchers(!color, kings_[color], 2, Pos::INVALID(), pos); }
 
+   unsigned long long hash() const {
+      unsigned long long retval = hash_ ^ ( color_ ? ZOBRIST.color : 0 );
+      for ( unsigned i = 0; i < NUMBER_OF_CASTS; i++ ) {
+         if ( casts_[i] != CHAR_INVALID ) {
+            retval ^= ZOBRIST.casts[i * NUMBER_OF_COLS + toupper(casts_[i]) - 'A'];
+         }
+      }
+      return hasEnpassantCapture() ? retval ^ ZOBRIST.enpassant[enpassant_ - 'a'] : retval;
+   }
+   // the file of a double push only makes a different position when a pawn can really take there
+   bool hasEnpassantCapture() const {
+      if ( enpassant_ == CHAR_INVALID ) {
+         return false;
+      }
+      const Pos to(color_ ? LAST_EMP_ROW : FIRST_EMP_ROW, enpassant_ - 'a');
+      for ( const int dcol : {-1, +1} ) {
+         const Pos from(color_ ? HALF_ROW : HALF_ROW - 1, to.col + dcol);
+         if ( getSquare(from) == ChessSquare(ChessFigure::Pawn, color_) && isMoveValid(from, to) ) {
+            return true;
+         }
+      }
+      return false;
+   }
+
+   unsigned count(const ChessSquare& sq, int row) const {
+      unsigned retval = 0;
+      for ( int col = 0; col < NUMBER_OF_COLS; col++ ) {
+         retval += data_.getSquare(Pos(row, col)) == sq;
+      }
+      return retval;
+   }
    unsigned count(const ChessSquare& sq) const {
       unsigned retval = 0;
-      for ( const auto& elem : data_ ) {
-         retval += elem.count(sq);
+      for ( int row = 0; row < NUMBER_OF_ROWS; row++ ) {
+         retval += count(sq, row);
       }
       return retval;
    }
@@ -269,16 +460,75 @@ struct ChessBoard {
    bool move(const std::string& desc);
    bool isMobilePiece(const Pos& pos, const ChessFigure& stype, unsigned char cktype, const Pos& checkerj) const;
    void listMobilePieces(MiniPosVector& pawns, MiniPosVector& pieces) const;
+   void listMobilePieces(MobilePieces& mobile) const;
+   // incremental version, prev is an earlier position with the same side to move (usually two plies back),
+   // with nibble rows it is no faster than the full scan, so only the verify mode uses it
+   void listMobilePieces(const ChessBoardT& prev, const MobilePieces& prevMobile, MobilePieces& mobile) const;
+   void listMoves(ChessMoveVector& moves) const;
+   void listMoves(ChessMoveArray& moves) const;
+   void listMoves(const MobilePieces& mobile, ChessMoveVector& moves) const; // the mobile pieces must be complete
+   void listMoves(const Pos& from, unsigned char check, ChessMoveVector& moves) const;
+   // the listing behind the ones above for any list with clear and push_back
+   template <class Moves> void addMoves(Moves& moves) const;
+   template <class Moves> void addMoves(const Pos& from, unsigned char check, Moves& moves) const;
    void debugPrint(std::ostream& os) const;
 
-   std::array<ChessRow, NUMBER_OF_ROWS> data_;
+   Storage data_;
    unsigned char color_; // white = true, blue = false, invalid state = 255
    std::array<char, NUMBER_OF_CASTS> casts_;
    char enpassant_;
    std::array<unsigned char, NUMBER_OF_CLOCKS> clocks_;
    std::array<Pos, NUMBER_OF_KINGS> kings_;
+   unsigned long long hash_; // squares only, the rest is added by hash()
 };
+typedef ChessBoardT<NibbleRows> ChessBoard;
 
 std::ostream& operator<<(std::ostream& os, const ChessBoard& board);
 
+// Attackers of every square for both colors, counted the way countWatchers does but in one pass over the pieces.
+// A square takes a byte per color: the number of attackers above the least valuable attacking figure.
+class SquareControl {
+public:
+   explicit SquareControl(const ChessBoard& board);
+
+   unsigned char count(bool color, const Pos& pos) const { return data_[color][pos.code()] >> 3; }
+   ChessFigure least(bool color, const Pos& pos) const { return ChessFigure(data_[color][pos.code()] & 7); }
+   // attacked by the opponent, and undefended, outnumbered, or attacked by a figure before it in the ChessFigure order
+   bool hanging(const ChessBoard& board, const Pos& pos) const;
+
+private:
+   void add(bool color, const Pos& pos, ChessFigure fig) {
+      auto& elem = data_[color][pos.code()];
+      elem = ( ( ( elem >> 3 ) + 1 ) << 3 ) | ( elem & 7 && ( elem & 7 ) < unsigned(fig) ? elem & 7 : unsigned(fig) );
+   }
+   std::array<std::array<unsigned char, NUMBER_OF_SQUARES>, 2> data_;
+};
+
+constexpr unsigned HISTORY_CAPACITY = 256; // the half move clock cannot look further back
+
+// Ring buffer of the position keys of a game, the current position is always the last one.
+class PositionHistory {
+public:
+   void clear() { size_ = 0; }
+   void push(const ChessBoard& board) { push(board.hash()); }
+   void push(unsigned long long key) { keys_[size_++ % HISTORY_CAPACITY] = key; }
+   void pop() { size_--; }
+   unsigned size() const { return size_; }
+   unsigned repetitions(unsigned char halfClock) const {
+      unsigned retval = 0;
+      if ( !size_ ) {
+         return retval;
+      }
+      const unsigned last = size_ - 1;
+      const unsigned limit = std::min<unsigned>(halfClock, last);
+      for ( unsigned back = 4; back <= limit; back += 2 ) {
+         retval += keys_[(last - back) % HISTORY_CAPACITY] == keys_[last % HISTORY_CAPACITY];
+      }
+      return retval;
+   }
+private:
+   std::array<unsigned long long, HISTORY_CAPACITY> keys_;
+   unsigned size_ = 0;
+};
+
 #endif /* PRIMITIVES_H */
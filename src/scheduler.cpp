@@ -0,0 +1,155 @@
+#include "scheduler.hpp"
+
+Scheduler::Scheduler(const Bitbases* bitbases, unsigned workers, size_t megabytes, size_t gameMegabytes, Callback played)
+   : bitbases_(bitbases), gameMegabytes_(std::max<size_t>(1, gameMegabytes)), played_(played) {
+   workers = std::max(1u, workers);
+   // a worker never waits for a table
+   maxTables_ = std::max<size_t>(workers, megabytes / gameMegabytes_);
+   for ( unsigned i = 0; i < workers; i++ ) {
+      workers_.push_back(std::thread(&Scheduler::work, this));
+   }
+}
+
+Scheduler::~Scheduler() {
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+   }
+   wake_.notify_all();
+   for ( auto& elem : workers_ ) {
+      elem.join();
+   }
+}
+
+unsigned
+Scheduler::add(const ChessBoard& board) {
+   std::lock_guard<std::mutex> lock(mutex_);
+   games_.emplace_back(new Game());
+   games_.back()->id = games_.size() - 1;
+   games_.back()->board = board;
+   games_.back()->history.push(board);
+   return games_.size() - 1;
+}
+
+bool
+Scheduler::move(unsigned game, const ChessMove& move) {
+   std::lock_guard<std::mutex> lock(mutex_);
+   if ( game >= games_.size() || games_[game]->thinking ) {
+      return false;
+   }
+   auto& elem = *games_[game];
+   elem.board.applyMove(move.from, move.to, move.promoteTo);
+   elem.history.push(elem.board);
+   return true;
+}
+
+bool
+Scheduler::think(unsigned game, unsigned milliseconds) {
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if ( game >= games_.size() || games_[game]->thinking ) {
+         return false;
+      }
+      auto& elem = *games_[game];
+      elem.deadline = Clock::now() + std::chrono::milliseconds(milliseconds);
+      elem.thinking = true;
+      elem.started = false;
+   }
+   wake_.notify_one();
+   return true;
+}
+
+// the earliest deadline first, among the games that have or can get a table
+Scheduler::Game*
+Scheduler::pick() {
+   Game* retval = nullptr;
+   bool idle = tables_ < maxTables_;
+   for ( const auto& elem : games_ ) {
+      idle = idle || ( elem->search && !elem->thinking );
+   }
+   for ( const auto& elem : games_ ) {
+      if ( elem->thinking && !elem->running && ( elem->search || idle ) && ( !retval || elem->deadline < retval->deadline ) ) {
+         retval = elem.get();
+      }
+   }
+   return retval;
+}
+
+bool
+Scheduler::evict() {
+   Game* victim = nullptr;
+   for ( const auto& elem : games_ ) {
+      if ( elem->search && !elem->thinking && ( !victim || elem->used < victim->used ) ) {
+         victim = elem.get();
+      }
+   }
+   if ( !victim ) {
+      return false;
+   }
+   victim->search.reset();
+   tables_--;
+   evictions_++;
+   return true;
+}
+
+void
+Scheduler::work() {
+   // running average of an iteration, it cannot be cut, so one is only started when it is expected to end in time
+   Clock::duration iteration = Clock::duration::zero();
+   std::unique_lock<std::mutex> lock(mutex_);
+   while ( !stop_ ) {
+      Game* game = pick();
+      if ( !game ) {
+         wake_.wait(lock);
+         continue;
+      }
+      game->running = true;
+      if ( !game->search ) {
+         if ( tables_ >= maxTables_ ) {
+            evict();
+         }
+         peakTables_ = std::max(peakTables_, ++tables_);
+         // pick and evict read the tables of the other games under the lock
+         game->search.reset(new Search(bitbases_, gameMegabytes_));
+      }
+      Search& search = *game->search;
+      const ChessBoard board = game->board;
+      const PositionHistory history = game->history;
+      const auto deadline = game->deadline;
+      const bool started = game->started;
+      game->started = true;
+      lock.unlock();
+
+      if ( !started ) {
+         search.begin(board);
+      }
+      auto now = Clock::now();
+      const auto end = std::min(deadline, now + std::chrono::microseconds(SCHEDULER_SLICE_US));
+      do {
+         search.step(board, history, 1);
+         iterations_++;
+         const auto last = now;
+         now = Clock::now();
+         iteration = ( iteration * 7 + ( now - last ) ) / 8;
+      } while ( now + iteration < end );
+      // rather a bit early than another iteration late
+      const bool due = now + iteration >= deadline;
+      const ChessMove best = due ? search.best(board) : ChessMove();
+
+      lock.lock();
+      game->running = false;
+      game->used = now;
+      if ( due ) {
+         game->thinking = false;
+         if ( best.from.valid() ) {
+            game->board.applyMove(best.from, best.to, best.promoteTo);
+            game->history.push(game->board);
+         }
+         lock.unlock();
+         played_(game->id, best);
+         lock.lock();
+      }
+      // a table became free or a game is ready again
+      wake_.notify_one();
+   }
+}
@@ -0,0 +1,77 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bitbase.hpp"
+#include "search.hpp"
+
+constexpr unsigned SCHEDULER_SLICE_US = 2000;
+constexpr size_t DEFAULT_GAME_HASH_MB = 1;
+
+// Many games in one process on a fixed pool of workers.
+// A game only thinks while the engine is to move, its search is cut into slices of SCHEDULER_SLICE_US
+// and the workers always continue the thinking game with the earliest deadline.
+// A slice holds at least one iteration, so with slow iterations it takes longer.
+// Every game has a search table of its own, kept between its moves. Once the tables would take more memory
+// than allowed, the table of the game idle for the longest time is dropped.
+class Scheduler {
+public:
+   typedef std::chrono::steady_clock Clock;
+   typedef std::function<void(unsigned game, const ChessMove& move)> Callback;
+
+   Scheduler(const Bitbases* bitbases, unsigned workers, size_t megabytes, size_t gameMegabytes, Callback played);
+   Scheduler(const Scheduler&) = delete;
+   Scheduler& operator=(const Scheduler&) = delete;
+   ~Scheduler();
+
+   unsigned add(const ChessBoard& board);
+   // the move of the opponent
+   bool move(unsigned game, const ChessMove& move);
+   // the engine is to move, played gets the move once the deadline is over
+   bool think(unsigned game, unsigned milliseconds);
+
+   unsigned long iterations() const { return iterations_; }
+   unsigned long evictions() const { return evictions_; }
+   size_t peakTables() const { return peakTables_; }
+
+private:
+   struct Game {
+      unsigned id;
+      ChessBoard board;
+      PositionHistory history;
+      std::unique_ptr<Search> search;
+      Clock::time_point deadline;
+      Clock::time_point used;
+      bool thinking = false;
+      bool started = false;
+      bool running = false;
+   };
+   Game* pick();
+   bool evict();
+   void work();
+
+   const Bitbases* bitbases_;
+   size_t gameMegabytes_;
+   size_t maxTables_;
+   Callback played_;
+   std::vector<std::unique_ptr<Game>> games_;
+   std::vector<std::thread> workers_;
+   std::mutex mutex_;
+   std::condition_variable wake_;
+   bool stop_ = false;
+   size_t tables_ = 0;
+   size_t peakTables_ = 0;
+   std::atomic<unsigned long> iterations_{0};
+   unsigned long evictions_ = 0;
+};
+
+#endif /* SCHEDULER_H */
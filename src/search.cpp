@@ -0,0 +1,302 @@
+#include "search.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+const double UCB_EXPLORATION = std::sqrt(2.0);
+
+void
+TranspositionTable::resize(size_t megabytes) {
+   size_t entries = TABLE_BUCKET_SIZE;
+   while ( entries * 2 * ( sizeof(TableEntry) + sizeof(ExpansionSlot) / TABLE_ENTRIES_PER_SLOT ) <= (megabytes << 20) ) {
+      entries *= 2;
+   }
+   const size_t slots = std::max<size_t>(1, entries / TABLE_ENTRIES_PER_SLOT);
+   entries_.reset(new TableEntry[entries]);
+   slots_.reset(new ExpansionSlot[slots]);
+   mask_ = entries - 1;
+   slotMask_ = slots - 1;
+   clear();
+}
+
+void
+TranspositionTable::clear() {
+   for ( size_t i = 0; i <= mask_; i++ ) {
+      entries_[i].key = 0;
+      entries_[i].visits = 0;
+      entries_[i].score = 0;
+      entries_[i].generation = 0;
+      entries_[i].expansion = 0;
+   }
+   for ( size_t i = 0; i <= slotMask_; i++ ) {
+      slots_[i].sequence = 0;
+      slots_[i].key = 0;
+   }
+   nextSlot_ = 0;
+}
+
+const TableEntry*
+TranspositionTable::find(unsigned long long key) const {
+   const size_t first = key & mask_ & ~size_t(TABLE_BUCKET_SIZE - 1);
+   for ( size_t i = first; i < first + TABLE_BUCKET_SIZE; i++ ) {
+      if ( entries_[i].key == key ) {
+         return &entries_[i];
+      }
+   }
+   return nullptr;
+}
+
+TableEntry*
+TranspositionTable::insert(unsigned long long key) {
+   const size_t first = key & mask_ & ~size_t(TABLE_BUCKET_SIZE - 1);
+   TableEntry* victim = nullptr;
+   for ( size_t i = first; i < first + TABLE_BUCKET_SIZE; i++ ) {
+      if ( entries_[i].key == key ) {
+         entries_[i].generation = generation_;
+         return &entries_[i];
+      }
+      // stale entries first, then the least visited
+      if ( !victim || std::make_pair(entries_[i].generation == generation_, entries_[i].visits.load()) < std::make_pair(victim->generation == generation_, victim->visits.load()) ) {
+         victim = &entries_[i];
+      }
+   }
+   victim->key = key;
+   victim->generation = generation_;
+   victim->visits = 0;
+   victim->score = 0;
+   return victim;
+}
+
+bool
+TranspositionTable::loadExpansion(const TableEntry* entry, unsigned long long key, MobilePieces& mobile) const {
+   const ExpansionSlot& slot = slots_[entry->expansion & slotMask_];
+   const unsigned sequence = slot.sequence;
+   if ( ( sequence & 1 ) || slot.key != key ) {
+      return false;
+   }
+   mobile.pawns = slot.pawns;
+   mobile.pieces = slot.pieces;
+   mobile.check = slot.check;
+   return slot.sequence == sequence;
+}
+
+void
+TranspositionTable::storeExpansion(TableEntry* entry, unsigned long long key, const MobilePieces& mobile) {
+   const size_t index = nextSlot_++ & slotMask_;
+   ExpansionSlot& slot = slots_[index];
+   unsigned sequence = slot.sequence;
+   // a slot taken by another writer right now stays theirs, the node is just listed again next time
+   if ( ( sequence & 1 ) || !slot.sequence.compare_exchange_strong(sequence, sequence + 1) ) {
+      return;
+   }
+   slot.key = key;
+   slot.pawns = mobile.pawns;
+   slot.pieces = mobile.pieces;
+   slot.check = mobile.check;
+   slot.sequence = sequence + 2;
+   entry->expansion = index;
+}
+
+void
+Search::expand(const ChessBoard& board, TableEntry* node, MobilePieces& mobile) {
+   const unsigned long long key = board.hash();
+   if ( !table_.loadExpansion(node, key, mobile) ) {
+      board.listMobilePieces(mobile);
+      table_.storeExpansion(node, key, mobile);
+   }
+}
+
+void
+Search::iterate(const ChessBoard& root, const PositionHistory& history, Worker& worker) {
+   ChessBoard board = root;
+   worker.history = history;
+   worker.path.clear();
+   TableEntry* node = table_.insert(board.hash());
+   unsigned visits = node->visits++; // counts as a loss until the score arrives, spreads the threads
+   worker.path.push_back(std::make_pair(node, !board.color_));
+   int result;
+   for ( ;; ) {
+      // a new leaf lists no moves, the playout finds the end of the game on its own
+      if ( !visits ) {
+         result = worker.playout.run(board, worker.rng, &worker.history);
+         break;
+      }
+      MobilePieces mobile;
+      expand(board, node, mobile);
+      if ( !mobile.pawns.size() && !mobile.pieces.size() ) {
+         result = mobile.check ? ( board.color_ ? -1 : +1 ) : 0;
+         break;
+      }
+      if ( worker.path.size() > 1 && ( board.clocks_[HALF_CLOCK] >= FIFTY_MOVES_CLOCK || worker.history.repetitions(board.clocks_[HALF_CLOCK]) ) ) {
+         result = 0;
+         break;
+      }
+      if ( worker.bitbases && worker.bitbases->probe(board, result) ) {
+         result = board.color_ ? result : -result;
+         break;
+      }
+
+      worker.froms.clear();
+      if ( mobile.complete() ) {
+         for ( size_t i = 0; i < mobile.pawns.size(); i++ ) {
+            worker.froms.push_back(get(mobile.pawns, i));
+         }
+         for ( size_t i = 0; i < mobile.pieces.size(); i++ ) {
+            worker.froms.push_back(get(mobile.pieces, i));
+         }
+      } else {
+         Pos pos;
+         for ( pos.row = 0; pos.row < NUMBER_OF_ROWS; pos.row++ ) {
+            for ( pos.col = 0; pos.col < NUMBER_OF_COLS; pos.col++ ) {
+               const auto psq = board.getSquareUnsafe(pos);
+               if ( !psq.empty() && psq.color() == board.color_ ) {
+                  worker.froms.push_back(pos);
+               }
+            }
+         }
+      }
+
+      // UCB1, unvisited children first in a random order
+      // the moves of a piece are only listed when the pieces before it have no unvisited child left,
+      // among the unvisited children of a piece each is equally likely
+      const double logVisits = std::log(double(visits));
+      const size_t size = worker.froms.size();
+      const size_t offset = worker.rng.below(size);
+      double bestValue = -1.0;
+      ChessBoard bestBoard;
+      unsigned unvisited = 0;
+      for ( size_t i = 0; i < size && !unvisited; i++ ) {
+         worker.moves.clear();
+         board.listMoves(worker.froms[(i + offset) % size], mobile.check, worker.moves);
+         for ( const auto& move : worker.moves ) {
+            ChessBoard next = board;
+            next.applyMove(move.from, move.to, move.promoteTo);
+            const TableEntry* entry = table_.find(next.hash());
+            const unsigned childVisits = entry ? entry->visits.load() : 0;
+            if ( !childVisits ) {
+               if ( !worker.rng.below(++unvisited) ) {
+                  bestBoard = next;
+               }
+               continue;
+            }
+            if ( unvisited ) {
+               continue;
+            }
+            const double value = entry->score / (2.0 * childVisits) + UCB_EXPLORATION * std::sqrt(logVisits / childVisits);
+            if ( value > bestValue ) {
+               bestValue = value;
+               bestBoard = next;
+            }
+         }
+      }
+      if ( !bestBoard.valid() ) {
+         result = worker.playout.run(board, worker.rng, &worker.history);
+         break;
+      }
+      board = bestBoard;
+      worker.history.push(board);
+      node = table_.insert(board.hash());
+      visits = node->visits++;
+      worker.path.push_back(std::make_pair(node, !board.color_));
+   }
+
+   for ( const auto& elem : worker.path ) {
+      elem.first->score += result ? ( (result > 0) == elem.second ? 2 : 0 ) : 1;
+   }
+}
+
+void
+Search::start(unsigned milliseconds, unsigned long iterations) {
+   stop_ = false;
+   limit_ = iterations;
+   if ( milliseconds ) {
+      setTimeLimit(milliseconds);
+   } else {
+      deadline_ = std::chrono::steady_clock::time_point::max().time_since_epoch().count();
+   }
+}
+
+const Bitbases*
+Search::prepare(const ChessBoard& board) {
+   iterations_ = 0;
+   table_.newGeneration();
+   const TableEntry* root = table_.find(board.hash());
+   reused_ = root ? root->visits.load() : 0;
+   // once the root is covered, every move keeps the result, only the playouts can show the way to the mate
+   int result;
+   return bitbases_ && !bitbases_->probe(board, result) ? bitbases_ : nullptr;
+}
+
+void
+Search::begin(const ChessBoard& board) {
+   stop_ = false;
+   stepper_.reset(new Worker(board.hash() ^ 1, prepare(board)));
+   stepper_->playout.setSampling(sampling_);
+}
+
+void
+Search::step(const ChessBoard& board, const PositionHistory& history, unsigned iterations) {
+   for ( unsigned i = 0; i < iterations && !stopped(); i++ ) {
+      iterate(board, history, *stepper_);
+      iterations_++;
+   }
+}
+
+ChessMove
+Search::run(const ChessBoard& board, const PositionHistory& history) {
+   const Bitbases* bitbases = prepare(board);
+   auto work = [&](unsigned long long seed) {
+      Worker worker(board.hash() ^ seed, bitbases);
+      worker.playout.setSampling(sampling_);
+      while ( !stopped() && std::chrono::steady_clock::now().time_since_epoch().count() < deadline_ && ( !limit_ || iterations_ < limit_ ) ) {
+         iterate(board, history, worker);
+         iterations_++;
+      }
+   };
+   std::vector<std::thread> helpers;
+   for ( unsigned i = 1; i < threads_; i++ ) {
+      helpers.push_back(std::thread(work, i + 1));
+   }
+   work(1);
+   for ( auto& elem : helpers ) {
+      elem.join();
+   }
+   return best(board);
+}
+
+void
+Search::setTimeLimit(unsigned milliseconds) {
+   deadline_ = (std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds)).time_since_epoch().count();
+}
+
+double
+Search::score(const ChessBoard& board, const ChessMove& move, unsigned& visits) const {
+   ChessBoard next = board;
+   next.applyMove(move.from, move.to, move.promoteTo);
+   return value(next, visits);
+}
+
+double
+Search::value(const ChessBoard& board, unsigned& visits) const {
+   const TableEntry* entry = table_.find(board.hash());
+   visits = entry ? entry->visits.load() : 0;
+   return visits ? entry->score / (2.0 * visits) : 0.5;
+}
+
+ChessMove
+Search::best(const ChessBoard& board) const {
+   ChessMoveVector moves;
+   board.listMoves(moves);
+   ChessMove retval;
+   unsigned bestVisits = 0;
+   for ( const auto& move : moves ) {
+      unsigned visits;
+      score(board, move, visits);
+      if ( visits > bestVisits || !retval.from.valid() ) {
+         bestVisits = visits;
+         retval = move;
+      }
+   }
+   return retval;
+}
@@ -0,0 +1,131 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bitbase.hpp"
+#include "playout.hpp"
+#include "primitives.hpp"
+
+const std::string ENGINE_NAME = "omice";
+constexpr unsigned DEFAULT_HASH_MB = 16;
+constexpr unsigned DEFAULT_MOVE_TIME = 30;
+constexpr unsigned DEFAULT_MOVES_TO_GO = 30;
+constexpr unsigned TABLE_BUCKET_SIZE = 4;
+constexpr unsigned TABLE_ENTRIES_PER_SLOT = 4; // most entries are leaves that never get expanded
+
+// Statistics of a position, shared by every move order leading to it.
+// The score is in half points for the side that moved into the position.
+// Once the node is expanded, expansion is the slot of its mobile pieces.
+struct TableEntry {
+   std::atomic<unsigned long long> key;
+   std::atomic<unsigned> visits;
+   std::atomic<unsigned> score;
+   std::atomic<unsigned> generation;
+   std::atomic<unsigned> expansion;
+};
+
+// Mobile pieces of an expanded node, the slots are handed out in a ring, so key tells whether they still belong to the node.
+// The sequence is odd while a writer fills the slot, a reader seeing it change drops what it read.
+struct ExpansionSlot {
+   std::atomic<unsigned> sequence;
+   std::atomic<unsigned> check;
+   std::atomic<unsigned long long> key;
+   std::atomic<MiniPosVector> pawns;
+   std::atomic<MiniPosVector> pieces;
+};
+
+// Fixed size, power of two, lock-free hash table of the Monte-Carlo statistics.
+// Colliding writers may mix up the statistics of an entry, that is just a bit of noise in the samples.
+// The table survives between searches, entries not touched since the last newGeneration are replaced first.
+// The mobile pieces of the expanded nodes live in a smaller pool of slots next to the entries.
+class TranspositionTable {
+public:
+   explicit TranspositionTable(size_t megabytes = DEFAULT_HASH_MB) { resize(megabytes); }
+
+   void resize(size_t megabytes);
+   void clear();
+   void newGeneration() { generation_++; }
+   size_t size() const { return mask_ + 1; }
+   const TableEntry* find(unsigned long long key) const;
+   TableEntry* insert(unsigned long long key);
+   // false if the node has no mobile pieces stored or their slot was taken over since
+   bool loadExpansion(const TableEntry* entry, unsigned long long key, MobilePieces& mobile) const;
+   void storeExpansion(TableEntry* entry, unsigned long long key, const MobilePieces& mobile);
+
+private:
+   std::unique_ptr<TableEntry[]> entries_;
+   std::unique_ptr<ExpansionSlot[]> slots_;
+   size_t mask_ = 0;
+   size_t slotMask_ = 0;
+   std::atomic<size_t> nextSlot_{0};
+   unsigned generation_ = 0;
+};
+
+// Monte-Carlo tree search where the tree is the transposition table itself.
+class Search {
+public:
+   explicit Search(const Bitbases* bitbases = nullptr, size_t megabytes = DEFAULT_HASH_MB) : bitbases_(bitbases), table_(megabytes) {}
+
+   void setHash(size_t megabytes) { table_.resize(megabytes); }
+   void setThreads(unsigned threads) { threads_ = std::max(1u, threads); }
+   void setSampling(bool sampling) { sampling_ = sampling; }
+   void clear() { table_.clear(); }
+
+   // arms the limits of the next run, milliseconds = 0 searches until stop or setTimeLimit, iterations = 0 has no limit
+   void start(unsigned milliseconds, unsigned long iterations = 0);
+   ChessMove run(const ChessBoard& board, const PositionHistory& history);
+   ChessMove run(const ChessBoard& board, const PositionHistory& history, unsigned milliseconds) {
+      start(milliseconds);
+      return run(board, history);
+   }
+   void setTimeLimit(unsigned milliseconds);
+   // cooperative searching in the calling thread: begin once per move, then step in slices, the limits are not used
+   void begin(const ChessBoard& board);
+   void step(const ChessBoard& board, const PositionHistory& history, unsigned iterations);
+   void stop() { stop_ = true; }
+   // a flag owned by the caller that stops the runs as well, unlike stop it is not cleared by start
+   void setCancel(const std::atomic<bool>* cancel) { cancel_ = cancel; }
+   unsigned long iterations() const { return iterations_; }
+   // visits of the root kept from the previous searches
+   unsigned reused() const { return reused_; }
+   // expected score of a move for the side to move in [0, 1], visits of the resulting position
+   double score(const ChessBoard& board, const ChessMove& move, unsigned& visits) const;
+   // expected score of a position for the side that moved into it
+   double value(const ChessBoard& board, unsigned& visits) const;
+   ChessMove best(const ChessBoard& board) const;
+
+private:
+   struct Worker {
+      Worker(unsigned long long seed, const Bitbases* pbitbases) : bitbases(pbitbases), rng(seed), playout(pbitbases) {}
+      const Bitbases* bitbases;
+      Random rng;
+      Playout playout;
+      ChessMoveVector moves;
+      PositionHistory history;
+      std::vector<std::pair<TableEntry*, bool>> path;
+      std::vector<Pos> froms;
+   };
+   const Bitbases* prepare(const ChessBoard& board);
+   void expand(const ChessBoard& board, TableEntry* node, MobilePieces& mobile);
+   void iterate(const ChessBoard& root, const PositionHistory& history, Worker& worker);
+   bool stopped() const { return stop_ || ( cancel_ && *cancel_ ); }
+
+   const Bitbases* bitbases_;
+   TranspositionTable table_;
+   unsigned threads_ = 1;
+   bool sampling_ = false;
+   std::atomic<bool> stop_{false};
+   const std::atomic<bool>* cancel_ = nullptr;
+   std::atomic<unsigned long> iterations_{0};
+   std::atomic<long long> deadline_{0};
+   unsigned long limit_ = 0;
+   unsigned reused_ = 0;
+   std::unique_ptr<Worker> stepper_;
+};
+
+#endif /* SEARCH_H */
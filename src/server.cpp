@@ -0,0 +1,260 @@
+#include "server.hpp"
+
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "uci.hpp"
+
+constexpr unsigned FEN_FIELDS = 6;
+
+static bool
+socketAddress(const std::string& path, sockaddr_un& addr) {
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   if ( path.size() >= sizeof(addr.sun_path) ) {
+      return false;
+   }
+   path.copy(addr.sun_path, path.size());
+   return true;
+}
+
+bool
+Connection::connect(const std::string& path) {
+   close();
+   sockaddr_un addr;
+   if ( !socketAddress(path, addr) ) {
+      return false;
+   }
+   fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+   return fd_ >= 0 && ::connect(fd_, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0;
+}
+
+void
+Connection::close() {
+   if ( fd_ >= 0 ) {
+      ::close(fd_);
+      fd_ = -1;
+   }
+   buffer_.clear();
+}
+
+bool
+Connection::readLine(std::string& line) {
+   for ( ;; ) {
+      const auto eol = buffer_.find('\n');
+      if ( eol != std::string::npos ) {
+         line = buffer_.substr(0, eol);
+         buffer_.erase(0, eol + 1);
+         return true;
+      }
+      char chunk[SOCKET_BUFFER_SIZE];
+      const ssize_t got = recv(fd_, chunk, sizeof(chunk), 0);
+      if ( got < 0 && errno == EINTR ) {
+         continue;
+      }
+      if ( got <= 0 ) {
+         return false;
+      }
+      buffer_.append(chunk, got);
+   }
+}
+
+bool
+Connection::writeLine(const std::string& line) {
+   const std::string data = line + "\n";
+   for ( size_t sent = 0; sent < data.size(); ) {
+      const ssize_t put = send(fd_, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+      if ( put < 0 && errno == EINTR ) {
+         continue;
+      }
+      if ( put <= 0 ) {
+         return false;
+      }
+      sent += put;
+   }
+   return true;
+}
+
+Server::Server(const Bitbases* bitbases, unsigned searchers, size_t megabytes) {
+   for ( unsigned i = 0; i < std::max(1u, searchers); i++ ) {
+      searches_.emplace_back(new Search(bitbases));
+      searches_.back()->setHash(megabytes);
+      idle_.push_back(searches_.back().get());
+   }
+}
+
+bool
+Server::listen(const std::string& path) {
+   sockaddr_un addr;
+   if ( !socketAddress(path, addr) ) {
+      return false;
+   }
+   listener_ = socket(AF_UNIX, SOCK_STREAM, 0);
+   if ( listener_ < 0 ) {
+      return false;
+   }
+   unlink(path.c_str());
+   if ( bind(listener_, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(listener_, SERVER_BACKLOG) != 0 ) {
+      ::close(listener_);
+      listener_ = -1;
+      return false;
+   }
+   path_ = path;
+   return true;
+}
+
+void
+Server::run() {
+   while ( !stop_ ) {
+      const int fd = accept(listener_, nullptr, nullptr);
+      if ( fd < 0 ) {
+         if ( errno == EINTR || errno == ECONNABORTED ) {
+            continue;
+         }
+         break;
+      }
+      std::lock_guard<std::mutex> lock(mutex_);
+      // accepted while stop ran, it would not wait for a thread started now
+      if ( stop_ ) {
+         ::close(fd);
+         break;
+      }
+      clients_.insert(fd);
+      std::thread(&Server::serve, this, fd).detach();
+   }
+}
+
+void
+Server::stop() {
+   stop_ = true;
+   std::unique_lock<std::mutex> lock(mutex_);
+   if ( listener_ >= 0 ) {
+      shutdown(listener_, SHUT_RDWR);
+      ::close(listener_);
+      listener_ = -1;
+      unlink(path_.c_str());
+   }
+   for ( auto fd : clients_ ) {
+      shutdown(fd, SHUT_RDWR);
+   }
+   for ( auto elem : cancels_ ) {
+      *elem = true;
+   }
+   finished_.wait(lock, [this]() { return clients_.empty(); });
+}
+
+void
+Server::serve(int fd) {
+   {
+      Connection connection(fd);
+      std::string line;
+      while ( !stop_ && connection.readLine(line) ) {
+         if ( line == "quit" || !connection.writeLine(answer(line)) ) {
+            break;
+         }
+      }
+   }
+   std::lock_guard<std::mutex> lock(mutex_);
+   clients_.erase(fd);
+   finished_.notify_all();
+}
+
+Search*
+Server::acquire(std::atomic<bool>& cancel) {
+   std::unique_lock<std::mutex> lock(mutex_);
+   available_.wait(lock, [this]() { return !idle_.empty(); });
+   Search* retval = idle_.back();
+   idle_.pop_back();
+   cancel = stop_.load();
+   cancels_.insert(&cancel);
+   retval->setCancel(&cancel);
+   return retval;
+}
+
+void
+Server::release(Search* search, std::atomic<bool>& cancel) {
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      search->setCancel(nullptr);
+      cancels_.erase(&cancel);
+      idle_.push_back(search);
+   }
+   available_.notify_one();
+}
+
+std::string
+Server::answer(const std::string& request) {
+   std::istringstream iss(request);
+   std::string command;
+   std::string fen;
+   std::string token;
+   iss >> command;
+   for ( unsigned i = 0; i < FEN_FIELDS && iss >> token; i++ ) {
+      fen += ( i ? " " : "" ) + token;
+   }
+   ChessBoard board;
+   if ( !board.initFEN(fen) ) {
+      return "error invalid FEN";
+   }
+   std::stringstream ss;
+   ss << "ok";
+   if ( command == "moves" ) {
+      ChessMoveVector moves;
+      board.listMoves(moves);
+      for ( const auto& elem : moves ) {
+         ss << " " << Uci::formatMove(board, elem, false);
+      }
+   } else if ( command == "mobile" ) {
+      MiniPosVector pawns;
+      MiniPosVector pieces;
+      board.listMobilePieces(pawns, pieces);
+      ss << " pawns";
+      for ( size_t i = 0; i < pawns.size(); i++ ) {
+         ss << " " << get(pawns, i);
+      }
+      ss << " pieces";
+      for ( size_t i = 0; i < pieces.size(); i++ ) {
+         ss << " " << get(pieces, i);
+      }
+   } else if ( command == "validate" ) {
+      ChessMove move;
+      if ( !( iss >> token ) || !Uci::parseMove(board, token, move) ) {
+         return "error invalid move";
+      }
+      ChessMoveVector moves;
+      board.listMoves(moves);
+      ss << ( std::find(moves.begin(), moves.end(), move) != moves.end() ? " legal" : " illegal" );
+   } else if ( command == "search" ) {
+      unsigned long milliseconds = DEFAULT_MOVE_TIME;
+      if ( iss >> token ) {
+         char* end = nullptr;
+         errno = 0;
+         milliseconds = strtoul(token.c_str(), &end, 10);
+         if ( !isdigit(token[0]) || *end || errno ) {
+            return "error invalid time";
+         }
+      }
+      PositionHistory history;
+      history.push(board);
+      std::atomic<bool> cancel{false};
+      Search* search = acquire(cancel);
+      const auto best = search->run(board, history, std::max(1ul, std::min(milliseconds, MAX_SEARCH_TIME)));
+      unsigned visits = 0;
+      const double score = best.from.valid() ? search->score(board, best, visits) : 0.5;
+      const auto iterations = search->iterations();
+      release(search, cancel);
+      if ( !best.from.valid() ) {
+         return "ok none";
+      }
+      ss << " bestmove " << Uci::formatMove(board, best, false) << " score " << score << " visits " << visits << " iterations " << iterations;
+   } else {
+      return "error unknown command " + command;
+   }
+   return ss.str();
+}
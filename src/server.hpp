@@ -0,0 +1,76 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bitbase.hpp"
+#include "search.hpp"
+
+constexpr unsigned SERVER_BACKLOG = 64;
+constexpr unsigned DEFAULT_SEARCHERS = 2;
+constexpr size_t SOCKET_BUFFER_SIZE = 4096;
+constexpr unsigned long MAX_SEARCH_TIME = 60000; // ms, longer requests are cut to it, 0 is taken as 1
+
+// Line oriented reads and writes on a stream socket.
+class Connection {
+public:
+   explicit Connection(int fd = -1) : fd_(fd) {}
+   Connection(const Connection&) = delete;
+   Connection& operator=(const Connection&) = delete;
+   ~Connection() { close(); }
+
+   bool connect(const std::string& path);
+   void close();
+   bool readLine(std::string& line);
+   bool writeLine(const std::string& line);
+   // one request and its answer
+   bool request(const std::string& line, std::string& answer) { return writeLine(line) && readLine(answer); }
+
+private:
+   int fd_;
+   std::string buffer_;
+};
+
+// Answers requests over a Unix domain socket, one thread per connection and one request per line:
+//    moves <fen>, mobile <fen>, validate <fen> <move>, search <fen> [milliseconds], quit
+// The FEN has all its six fields, the answer is one line starting with "ok" or "error".
+// The search tables are allocated once and handed out to the requests, they stay warm between them.
+class Server {
+public:
+   Server(const Bitbases* bitbases, unsigned searchers, size_t megabytes);
+   Server(const Server&) = delete;
+   Server& operator=(const Server&) = delete;
+   ~Server() { stop(); }
+
+   bool listen(const std::string& path);
+   // accepts connections until stop
+   void run();
+   void stop();
+   std::string answer(const std::string& request);
+
+private:
+   void serve(int fd);
+   // hands out a search and ties the cancel flag of the request to it, the flag is set at once when stopping
+   Search* acquire(std::atomic<bool>& cancel);
+   void release(Search* search, std::atomic<bool>& cancel);
+
+   std::vector<std::unique_ptr<Search>> searches_;
+   std::vector<Search*> idle_;
+   std::condition_variable available_;
+   std::condition_variable finished_;
+   std::mutex mutex_;
+   std::set<int> clients_; // their threads are detached, stop waits until the set is empty
+   std::set<std::atomic<bool>*> cancels_; // of the running searches
+   std::string path_;
+   int listener_ = -1;
+   std::atomic<bool> stop_{false};
+};
+
+#endif /* SERVER_H */
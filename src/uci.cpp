@@ -0,0 +1,226 @@
+#include "uci.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <sstream>
+
+constexpr unsigned long MAX_HASH_MB = 65536;
+constexpr unsigned long MAX_THREADS = 1024;
+
+// a spin option value, clamped to the bounds advertised for it, false if it is not a number
+static bool
+parseSpin(const std::string& text, unsigned long min, unsigned long max, unsigned long& value) {
+   if ( text.empty() || !isdigit(text[0]) ) {
+      return false;
+   }
+   char* end = nullptr;
+   errno = 0;
+   value = strtoul(text.c_str(), &end, 10);
+   if ( *end ) {
+      return false;
+   }
+   value = errno ? max : std::min(std::max(value, min), max);
+   return true;
+}
+
+bool
+Uci::parseMove(const ChessBoard& board, const std::string& token, ChessMove& move) {
+   if ( token.size() < 4 ) {
+      return false;
+   }
+   move = ChessMove(Pos(token[1] - '1', token[0] - 'a'), Pos(token[3] - '1', token[2] - 'a'), token.size() > 4 ? toFigure(token[4]) : ChessFigure::None);
+   if ( !move.from.valid() || !move.to.valid() ) {
+      return false;
+   }
+   // e1g1 style castling becomes king takes own rook
+   const auto sq = board.getSquare(move.from);
+   if ( sq.figure() == ChessFigure::King && move.from.row == move.to.row && tabs(move.to.col - move.from.col) > 1 && !( board.getSquare(move.to) == ChessSquare(ChessFigure::Rook, sq.color()) ) ) {
+      move.to = board.getCastPos(sq.color(), move.to.col > move.from.col);
+   }
+   return true;
+}
+
+std::string
+Uci::formatMove(const ChessBoard& board, const ChessMove& move, bool chess960) {
+   std::stringstream ss;
+   const auto sq = board.getSquare(move.from);
+   if ( !chess960 && sq.figure() == ChessFigure::King && board.getSquare(move.to) == ChessSquare(ChessFigure::Rook, sq.color()) ) {
+      ss << move.from << Pos(move.from.row, move.to.col < move.from.col ? LONG_CASTLE_KING : SHORT_CASTLE_KING);
+   } else {
+      ss << move;
+   }
+   return ss.str();
+}
+
+void
+Uci::setOption(std::istream& is) {
+   std::string token, name, value;
+   while ( is >> token && token != "value" ) {
+      if ( token != "name" ) {
+         name += name.empty() ? token : " " + token;
+      }
+   }
+   is >> value;
+   unsigned long number = 0;
+   if ( name == "Hash" ) {
+      if ( parseSpin(value, 1, MAX_HASH_MB, number) ) {
+         search_.setHash(number);
+      }
+   } else if ( name == "Threads" ) {
+      if ( parseSpin(value, 1, MAX_THREADS, number) ) {
+         search_.setThreads(number);
+      }
+   } else if ( name == "UCI_Chess960" ) {
+      chess960_ = value == "true";
+   } else if ( name == "Sampling" ) {
+      search_.setSampling(value == "true");
+   }
+}
+
+bool
+Uci::position(std::istream& is) {
+   std::string token;
+   is >> token;
+   if ( token == "startpos" ) {
+      board_.init();
+      is >> token;
+   } else if ( token == "fen" ) {
+      std::string fen;
+      while ( is >> token && token != "moves" ) {
+         fen += token + " ";
+      }
+      if ( !board_.initFEN(fen) ) {
+         return false;
+      }
+   }
+   history_.clear();
+   history_.push(board_);
+   while ( is >> token ) {
+      ChessMove move;
+      if ( !parseMove(board_, token, move) || !board_.move(move.from, move.to, move.promoteTo == ChessFigure::None ? ChessFigure::Queen : move.promoteTo) ) {
+         return false;
+      }
+      history_.push(board_);
+   }
+   return true;
+}
+
+void
+Uci::go(std::istream& is, std::ostream& os) {
+   std::string token;
+   unsigned time = 0;
+   unsigned moveTime = 0;
+   unsigned increment = 0;
+   unsigned movesToGo = 0;
+   unsigned long nodes = 0;
+   bool infinite = false;
+   bool ponder = false;
+   while ( is >> token ) {
+      unsigned value = 0;
+      if ( token == "movetime" || token == "wtime" || token == "btime" || token == "winc" || token == "binc" || token == "movestogo" ) {
+         is >> value;
+      }
+      if ( token == "nodes" ) {
+         is >> nodes;
+      } else if ( token == "movetime" ) {
+         moveTime = value;
+      } else if ( token == (board_.color_ ? "wtime" : "btime") ) {
+         time = value;
+      } else if ( token == (board_.color_ ? "winc" : "binc") ) {
+         increment = value;
+      } else if ( token == "movestogo" ) {
+         movesToGo = value;
+      } else if ( token == "infinite" ) {
+         infinite = true;
+      } else if ( token == "ponder" ) {
+         ponder = true;
+      }
+   }
+   if ( !moveTime && nodes && !time ) {
+      infinite = true;
+   } else if ( !moveTime ) {
+      moveTime = time ? time / ( movesToGo ? movesToGo + 1 : DEFAULT_MOVES_TO_GO ) + increment / 2 : DEFAULT_MOVE_TIME;
+      // a large increment must not spend the clock, half of it stays as a reserve
+      if ( time ) {
+         moveTime = std::max(1u, std::min(moveTime, time / 2));
+      }
+   }
+   ponderTime_ = moveTime;
+   search_.start(infinite || ponder ? 0 : moveTime, nodes);
+   searcher_ = std::thread([this, &os]() {
+      auto t1 = std::chrono::steady_clock::now();
+      const auto move = search_.run(board_, history_);
+      auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t1).count();
+      std::lock_guard<std::mutex> lock(output_);
+      os << "info nodes " << search_.iterations() << " time " << elapsed << " string reused " << search_.reused() << std::endl;
+      if ( !move.from.valid() ) {
+         os << "bestmove 0000" << std::endl;
+         return;
+      }
+      os << "bestmove " << formatMove(board_, move, chess960_);
+      ChessBoard next = board_;
+      next.applyMove(move.from, move.to, move.promoteTo);
+      const auto reply = search_.best(next);
+      unsigned visits = 0;
+      if ( reply.from.valid() && ( search_.score(next, reply, visits), visits ) ) {
+         os << " ponder " << formatMove(next, reply, chess960_);
+      }
+      os << std::endl;
+   });
+}
+
+void
+Uci::wait() {
+   if ( searcher_.joinable() ) {
+      searcher_.join();
+   }
+}
+
+void
+Uci::loop(std::istream& is, std::ostream& os) {
+   std::string line;
+   while ( getline(is, line) ) {
+      std::istringstream iss(line);
+      std::string command;
+      iss >> command;
+      // only stop and ponderhit talk to a running search, anything else waits for it
+      if ( command == "stop" ) {
+         search_.stop();
+         wait();
+         continue;
+      } else if ( command == "ponderhit" ) {
+         search_.setTimeLimit(ponderTime_);
+         continue;
+      } else if ( command == "quit" ) {
+         search_.stop();
+         break;
+      } else if ( command == "isready" ) {
+         std::lock_guard<std::mutex> lock(output_);
+         os << "readyok" << std::endl;
+         continue;
+      }
+      wait();
+      std::lock_guard<std::mutex> lock(output_);
+      if ( command == "uci" ) {
+         os << "id name " << ENGINE_NAME << std::endl;
+         os << "option name Hash type spin default " << DEFAULT_HASH_MB << " min 1 max " << MAX_HASH_MB << std::endl;
+         os << "option name Threads type spin default 1 min 1 max " << MAX_THREADS << std::endl;
+         os << "option name Ponder type check default false" << std::endl;
+         os << "option name UCI_Chess960 type check default false" << std::endl;
+         os << "option name Sampling type check default false" << std::endl;
+         os << "uciok" << std::endl;
+      } else if ( command == "setoption" ) {
+         setOption(iss);
+      } else if ( command == "ucinewgame" ) {
+         search_.clear();
+      } else if ( command == "position" ) {
+         if ( !position(iss) ) {
+            os << "info string invalid position" << std::endl;
+         }
+      } else if ( command == "go" ) {
+         go(iss, os);
+      }
+   }
+}
@@ -0,0 +1,43 @@
+#ifndef UCI_H
+#define UCI_H
+
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "search.hpp"
+
+// Universal Chess Interface on top of the Monte-Carlo search.
+class Uci {
+public:
+   explicit Uci(const Bitbases* bitbases) : search_(bitbases) {
+      board_.init();
+      history_.push(board_);
+   }
+   ~Uci() {
+      search_.stop();
+      wait();
+   }
+
+   void loop(std::istream& is, std::ostream& os);
+
+   static bool parseMove(const ChessBoard& board, const std::string& token, ChessMove& move);
+   static std::string formatMove(const ChessBoard& board, const ChessMove& move, bool chess960);
+
+private:
+   void setOption(std::istream& is);
+   bool position(std::istream& is);
+   void go(std::istream& is, std::ostream& os);
+   void wait();
+
+   Search search_;
+   ChessBoard board_;
+   PositionHistory history_;
+   bool chess960_ = false;
+   std::thread searcher_;
+   std::mutex output_;
+   unsigned ponderTime_ = 0; // time for the move once the ponder move is played
+};
+
+#endif /* UCI_H */
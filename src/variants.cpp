@@ -0,0 +1,116 @@
+#include "variants.hpp"
+
+VariantTrie::VariantTrie(const std::vector<Game>& games) : games_(games) {
+   std::map<std::string, size_t> roots;
+   for ( size_t i = 0; i < games.size(); i++ ) {
+      auto it = roots.find(games[i].fen);
+      if ( it == roots.end() ) {
+         it = roots.insert(std::make_pair(games[i].fen, nodes_.size())).first;
+         roots_.push_back(nodes_.size());
+         nodes_.push_back(Node());
+         nodes_.back().token = games[i].fen;
+         nodes_.back().number = 0;
+      }
+      size_t node = it->second;
+      for ( size_t j = 0; j < games[i].moves.size(); j++ ) {
+         node = child(node, games[i].moves[j], games[i].numbers[j]);
+      }
+      nodes_[node].games.push_back(i);
+      moves_ += games[i].moves.size();
+   }
+}
+
+size_t
+VariantTrie::child(size_t node, const std::string& token, unsigned number) {
+   for ( auto elem : nodes_[node].children ) {
+      if ( nodes_[elem].token == token && nodes_[elem].number == number ) {
+         return elem;
+      }
+   }
+   nodes_[node].children.push_back(nodes_.size());
+   nodes_.push_back(Node());
+   nodes_.back().token = token;
+   nodes_.back().number = number;
+   return nodes_.size() - 1;
+}
+
+void
+VariantTrie::report(size_t game) {
+   for ( const auto& elem : path_ ) {
+      messages_[game].push_back("NOTE: " + games_[game].tag + elem);
+   }
+}
+
+void
+VariantTrie::fail(size_t node, const std::string& message) {
+   for ( auto elem : nodes_[node].games ) {
+      report(elem);
+      messages_[elem].push_back("ERROR: " + games_[elem].tag + message);
+   }
+   for ( auto elem : nodes_[node].children ) {
+      fail(elem, message);
+   }
+}
+
+void
+VariantTrie::replay(size_t node, ChessBoard& board) {
+   for ( auto elem : nodes_[node].games ) {
+      report(elem);
+      (*boards_)[games_[elem].tag] = board;
+   }
+   // the board is only copied where the variants fork, the last child takes it over
+   const auto& children = nodes_[node].children;
+   for ( size_t i = 0; i < children.size(); i++ ) {
+      ChessBoard copy;
+      ChessBoard& next = i + 1 < children.size() ? ( copy = board ) : board;
+      const auto& token = nodes_[children[i]].token;
+      const unsigned number = nodes_[children[i]].number;
+      const unsigned plies = history_.size() - 1;
+      if ( number && plies != ( number - 1 ) * 2 ) {
+         fail(children[i], " bad number " + std::to_string(number) + " vs. " + std::to_string(plies));
+         continue;
+      }
+      if ( !next.move(token) ) {
+         fail(children[i], " cannot apply move " + token);
+         continue;
+      }
+      if ( !next.valid() ) {
+         fail(children[i], " move " + token + " led to failure");
+         continue;
+      }
+      replayed_++;
+      history_.push(next);
+      const bool repeated = history_.repetitions(next.clocks_[HALF_CLOCK]) == 2;
+      if ( repeated ) {
+         path_.push_back(" threefold repetition after " + token);
+      }
+      replay(children[i], next);
+      if ( repeated ) {
+         path_.pop_back();
+      }
+      history_.pop();
+   }
+}
+
+void
+VariantTrie::replay(std::map<std::string, ChessBoard>& boards, std::vector<std::string>& messages) {
+   boards_ = &boards;
+   messages_.assign(games_.size(), std::vector<std::string>());
+   replayed_ = 0;
+   for ( auto root : roots_ ) {
+      Game start;
+      start.fen = nodes_[root].token;
+      ChessBoard board;
+      if ( !start.start(board) ) {
+         fail(root, " invalid FEN " + start.fen);
+         continue;
+      }
+      history_.clear();
+      history_.push(board);
+      replay(root, board);
+   }
+   for ( const auto& elem : messages_ ) {
+      messages.insert(messages.end(), elem.begin(), elem.end());
+   }
+   boards_ = nullptr;
+}
@@ -0,0 +1,49 @@
+#ifndef VARIANTS_H
+#define VARIANTS_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "notation.hpp"
+#include "primitives.hpp"
+
+// The variants of an input file merged on their common first moves, so that every shared prefix is replayed once.
+// Variants with the same FEN share a root, the tokens are kept as written together with the move number before them,
+// and checked only while replaying.
+class VariantTrie {
+public:
+   explicit VariantTrie(const std::vector<Game>& games);
+
+   // final boards of the valid variants by tag, errors and notes in the order of the games
+   void replay(std::map<std::string, ChessBoard>& boards, std::vector<std::string>& messages);
+   // moves written in the variants, distinct moves in the trie, moves applied by the last replay
+   size_t moves() const { return moves_; }
+   size_t nodes() const { return nodes_.size() - roots_.size(); }
+   size_t replayed() const { return replayed_; }
+
+private:
+   struct Node {
+      std::string token;
+      unsigned number; // 0 if none was written
+      std::vector<size_t> children;
+      std::vector<size_t> games; // ending here
+   };
+   size_t child(size_t node, const std::string& token, unsigned number);
+   void replay(size_t node, ChessBoard& board);
+   void report(size_t game);
+   void fail(size_t node, const std::string& message);
+
+   const std::vector<Game>& games_;
+   std::vector<Node> nodes_;
+   std::vector<size_t> roots_;
+   size_t moves_ = 0;
+   size_t replayed_ = 0;
+   // state of a replay
+   std::map<std::string, ChessBoard>* boards_ = nullptr;
+   std::vector<std::vector<std::string>> messages_; // by game
+   std::vector<std::string> path_; // notes on the way to the current node
+   PositionHistory history_;
+};
+
+#endif /* VARIANTS_H */
@@ -3,3 +3,8 @@
 use strict;
 
 system("./omice input my_first_test_input.txt");
+
+# a blunder gets marked already at the default move time
+my $annotated = `echo '(B) 1. e4 e5 2. Bc4 Nc6 3. Qh5 Nf6 4. Qxf7#' | ./omice annotate /dev/stdin`;
+die "ERROR: the blunder 3... Nf6 is not marked:\n$annotated" if $annotated !~ /Nf6\?\?/;
+print "annotate: ok\n";